@@ -51,7 +51,9 @@ void onError(int error, const char *description) {
     fprintf(stderr, "Error (%d): %s\n", error, description);
 }
 
-void onFramebufferSize(GLFWwindow *Window, int Width, int Height) {}
+void onFramebufferSize(GLFWwindow *Window, int Width, int Height) {
+    if (Renderer) { Renderer->framebufferResized(); }
+}
 
 void onKey(GLFWwindow *Window, int Key, int Scancode, int Action, int Mods) {}
 
@@ -73,6 +75,9 @@ int main(int argc, char **argv) {
     rendererInfo.debug      = enableDebug;
     rendererInfo.trace      = enableTrace;
 
+    // Nothing moves unless the window changes, so only draw then.
+    rendererInfo.renderOnDemand = true;
+
     vkmol::renderer::RendererWSIDelegate rendererDelegate;
     rendererDelegate.getInstanceExtensions = [&]() {
         uint32_t     count;
@@ -97,14 +102,68 @@ int main(int argc, char **argv) {
         glfwGetFramebufferSize(window, &width, &height);
         return std::make_tuple(width, height);
     };
+    rendererDelegate.wake = []() { glfwPostEmptyEvent(); };
     rendererInfo.delegate = rendererDelegate;
 
 
     try {
         Renderer = new vkmol::renderer::Renderer(rendererInfo);
 
+        vkmol::renderer::FrameGraph frameGraph(*Renderer);
+
         while (!glfwWindowShouldClose(window)) {
+            // Sleep until there is something to draw.
+            if (!Renderer->needsFrame()) {
+                glfwWaitEvents();
+                continue;
+            }
             glfwPollEvents();
+
+            auto commandBuffer = Renderer->beginFrame();
+
+            vk::Image image = Renderer->getSwapchainImage();
+            if (image) {
+                frameGraph.reset();
+
+                auto target = frameGraph.importImage(
+                    "swapchain", image, Renderer->getSwapchainImageView(),
+                    Renderer->getSwapchainFormat(),
+                    Renderer->getSwapchainExtent(),
+                    vk::ImageLayout::eUndefined,
+                    vk::ImageLayout::ePresentSrcKHR);
+
+                // Without transfer usage the image cannot be cleared this
+                // way, and is only transitioned for presenting, its
+                // contents undefined.
+                bool clear  = Renderer->canTransferToSwapchain();
+                auto access =
+                    clear ? vkmol::renderer::ImageAccess::TransferDestination
+                          : vkmol::renderer::ImageAccess::ColorAttachment;
+
+                frameGraph.addPass(
+                    "clear",
+                    [&](vkmol::renderer::FrameGraph::Builder &builder) {
+                        builder.write(target, access);
+                    },
+                    [&](vk::CommandBuffer                  commandBuffer,
+                        const vkmol::renderer::FrameGraph &graph) {
+                        if (!clear) return;
+
+                        vk::ClearColorValue color(
+                            std::array<float, 4>{{0.1f, 0.1f, 0.1f, 1.0f}});
+                        vk::ImageSubresourceRange range(
+                            vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+                        commandBuffer.clearColorImage(
+                            graph.getImage(target),
+                            vk::ImageLayout::eTransferDstOptimal, color,
+                            range);
+                    });
+
+                frameGraph.compile();
+                frameGraph.execute(commandBuffer);
+            }
+
+            Renderer->endFrame();
         }
     } catch (std::runtime_error err) {
         std::cerr << "Fatal error: " << err.what() << std::endl;
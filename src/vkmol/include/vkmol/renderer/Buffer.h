@@ -35,7 +35,7 @@ namespace renderer {
 
 enum class BufferType : uint8_t { Invalid, Vertex, Index, Uniform, Any };
 
-enum class BufferAllocationType : bool { Default = false, Ring = true };
+enum class BufferAllocationType : uint8_t { Default, Ring, Pooled };
 
 struct Buffer {
     BufferType           type;
@@ -0,0 +1,93 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_FRAME_H
+#define VKMOL_RENDERER_FRAME_H
+
+#include "Resource.h"
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace vkmol {
+namespace renderer {
+
+/*
+ * Everything a frame needs until the GPU is done with it. The renderer keeps
+ * a ring of these, indexed by frame number modulo its size, and reuses a
+ * slot only after waiting for the fence of the frame last recorded into it.
+ * Until then the CPU is free to record the frames in between.
+ */
+struct Frame {
+    // The frame last recorded into this slot, zero if there was none.
+    uint32_t number = 0;
+
+    // Reset as a whole when the slot is reused, which resets both command
+    // buffers. The copy batch is submitted ahead of the frame's commands,
+    // which are only submitted if the frame was begun.
+    vk::CommandPool   commandPool;
+    vk::CommandBuffer commandBuffer;
+    vk::CommandBuffer copyCommandBuffer;
+    bool              begun   = false;
+    bool              copying = false;
+
+    // Secondary command buffers recorded by recordParallel(), from a pool
+    // per recording thread since pools may only be used by one thread at a
+    // time. They are reset along with the frame's own pool.
+    struct ThreadCommands {
+        vk::CommandPool                commandPool;
+        std::vector<vk::CommandBuffer> commandBuffers;
+        size_t                         used = 0;
+    };
+
+    std::vector<ThreadCommands> threadCommands;
+
+    // Whether the frame's command buffer wrote its timestamps, and the
+    // resolution scale it was recorded at.
+    bool  timed           = false;
+    float resolutionScale = 1.0f;
+
+    // Signaled by the frame's submission, copy batch included. Null when
+    // the renderer has timeline semaphores, as it then waits on those.
+    vk::Fence fence;
+
+    // Swapchain image acquisition and presentation, if an image was
+    // acquired for the frame.
+    vk::Semaphore acquireSemaphore;
+    vk::Semaphore finishedSemaphore;
+    bool          imageAcquired = false;
+    uint32_t      imageIndex    = 0;
+
+    // The frame's partition of the ring buffer and the staging ring ends
+    // here; it began where the previous frame's ended.
+    size_t ringBufferEnd  = 0;
+    size_t stagingRingEnd = 0;
+
+    // Resources deleted during the frame, destroyed once it is synced.
+    std::vector<Resource> deletions;
+};
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif
@@ -0,0 +1,278 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_FRAMEGRAPH_H
+#define VKMOL_RENDERER_FRAMEGRAPH_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// TODO: do we have to import this publicly...?
+#include <vkmol/private/vma/vk_mem_alloc.h>
+
+namespace vkmol {
+namespace renderer {
+
+class Renderer;
+
+// How a pass uses an image, which determines its layout, the pipeline
+// stages and access types to synchronize, and the image's usage flags.
+enum class ImageAccess : uint8_t {
+    ColorAttachment,
+    DepthAttachment,
+    DepthRead,
+    Sampled,
+    Storage,
+    TransferSource,
+    TransferDestination
+};
+
+struct TransientImageDesc {
+    uint32_t                width   = 0;
+    uint32_t                height  = 0;
+    vk::Format              format  = vk::Format::eUndefined;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+};
+
+// Refers to an image of the graph being built; only valid until reset().
+struct FrameGraphImage {
+    uint32_t index = UINT32_MAX;
+
+    bool isValid() const { return index != UINT32_MAX; }
+};
+
+struct FrameGraphStatistics {
+    uint32_t passes       = 0;
+    uint32_t culledPasses = 0;
+    uint32_t barriers     = 0;
+
+    // What the transient images would take on their own, and what they take
+    // sharing memory where their lifetimes do not overlap.
+    size_t transientBytes = 0;
+    size_t allocatedBytes = 0;
+};
+
+/*
+ * Passes declare the images they read and write, and the graph works out
+ * the rest when compiled:
+ *
+ * - Passes that contribute nothing to an output (an imported image, an
+ *   image marked as output, or a pass with side effects) are culled.
+ * - Each pass is preceded by one pipeline barrier covering the layout
+ *   transitions and hazards of what it uses, and nothing more; reads after
+ *   reads in the same layout need no barrier at all.
+ * - Transient images are created by the graph, and those whose lifetimes
+ *   do not overlap are bound to the same memory.
+ *
+ * The graph is meant to be rebuilt every frame: reset(), add passes,
+ * compile(), execute(). Transient images are kept across frames as long as
+ * the transients of successive graphs match, so a steady state allocates
+ * nothing; when they change (e.g. on resize) the old images are destroyed
+ * once the frames using them are synced.
+ */
+class FrameGraph {
+public:
+    class Builder {
+    private:
+        friend class FrameGraph;
+
+        FrameGraph &graph;
+        uint32_t    pass;
+
+        Builder(FrameGraph &graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+    public:
+        FrameGraphImage create(const std::string &       name,
+                               const TransientImageDesc &desc);
+
+        // An image may be used only once per pass.
+        void read(FrameGraphImage image, ImageAccess access);
+        void write(FrameGraphImage image, ImageAccess access);
+
+        // Keeps the pass even if nothing reads what it writes, e.g. a
+        // picking pass read back by the host.
+        void setSideEffects() { graph.passes[pass].sideEffects = true; }
+    };
+
+    typedef std::function<void(Builder &)> SetupCallback;
+    typedef std::function<void(vk::CommandBuffer, const FrameGraph &)>
+        ExecuteCallback;
+
+private:
+    struct Use {
+        uint32_t    image  = 0;
+        ImageAccess access = ImageAccess::Sampled;
+        bool        write  = false;
+    };
+
+    struct Pass {
+        std::string      name;
+        ExecuteCallback  execute;
+        std::vector<Use> uses;
+        bool             sideEffects = false;
+        bool             live        = false;
+
+        vk::PipelineStageFlags              sourceStages;
+        vk::PipelineStageFlags              destinationStages;
+        std::vector<vk::ImageMemoryBarrier> barriers;
+    };
+
+    struct Image {
+        std::string         name;
+        TransientImageDesc  desc;
+        vk::ImageUsageFlags usage;
+        bool                imported = false;
+        bool                output   = false;
+        bool                live     = false;
+
+        // Live passes using the image, by index.
+        uint32_t firstPass = UINT32_MAX;
+        uint32_t lastPass  = 0;
+
+        // For transients, the index into physicalImages.
+        uint32_t physical = UINT32_MAX;
+
+        vk::Image       image;
+        vk::ImageView   view;
+        vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined;
+        vk::ImageLayout finalLayout   = vk::ImageLayout::eUndefined;
+    };
+
+    // Transient images as created, in the order of the live transients
+    // they were created for, and the memory they share.
+    struct PhysicalImage {
+        TransientImageDesc  desc;
+        vk::ImageUsageFlags usage;
+        uint32_t            firstPass = 0;
+        uint32_t            lastPass  = 0;
+
+        vk::Image              image;
+        vk::ImageView          view;
+        vk::MemoryRequirements requirements;
+        uint32_t               memory = 0;
+
+        // The image last using the same memory before this one, if any.
+        uint32_t aliased = UINT32_MAX;
+    };
+
+    struct Retired {
+        uint32_t                   frame = 0;
+        std::vector<PhysicalImage> images;
+        std::vector<VmaAllocation> memory;
+    };
+
+    Renderer &renderer;
+
+    std::vector<Pass>  passes;
+    std::vector<Image> images;
+    bool               compiled = false;
+
+    std::vector<PhysicalImage> physicalImages;
+    std::vector<VmaAllocation> physicalMemory;
+
+    // Per physical memory, the stages and writes its last image was left
+    // with by the graph last executed, and by the one compiled. Every frame
+    // in flight shares the transients, so the first use of each memory in
+    // a frame waits on the previous frame's last.
+    struct MemoryState {
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags        writes;
+    };
+
+    std::vector<MemoryState> executedStates;
+    std::vector<MemoryState> compiledStates;
+    std::vector<Retired>       retired;
+    uint32_t                   lastExecutedFrame = 0;
+
+    vk::PipelineStageFlags              finalSourceStages;
+    std::vector<vk::ImageMemoryBarrier> finalBarriers;
+
+    FrameGraphStatistics statistics;
+
+    void cull();
+    void allocateTransients();
+    void computeBarriers();
+    void retirePhysical();
+    void collectRetired(bool all);
+    void destroyPhysical(std::vector<PhysicalImage> &images,
+                         std::vector<VmaAllocation> &memory);
+
+public:
+#pragma mark - Lifecycle
+
+    explicit FrameGraph(Renderer &renderer);
+
+    FrameGraph(const FrameGraph &) = delete;
+    FrameGraph &operator=(const FrameGraph &) = delete;
+
+    FrameGraph(FrameGraph &&) = delete;
+    FrameGraph &operator=(FrameGraph &&) = delete;
+
+    // Waits for the last frame the graph was executed in.
+    ~FrameGraph();
+
+#pragma mark - Building
+
+    // Forgets the passes and images, but keeps the transient images for
+    // the next compile() to reuse.
+    void reset();
+
+    // An image owned by someone else, e.g. a swapchain image. It is
+    // expected in initialLayout, and left in finalLayout. Writes to it
+    // count as outputs.
+    FrameGraphImage importImage(const std::string &name,
+                                vk::Image          image,
+                                vk::ImageView      view,
+                                vk::Format         format,
+                                vk::Extent2D       extent,
+                                vk::ImageLayout    initialLayout,
+                                vk::ImageLayout    finalLayout);
+
+    void markOutput(FrameGraphImage image);
+
+    void addPass(const std::string &   name,
+                 const SetupCallback & setup,
+                 const ExecuteCallback &execute);
+
+#pragma mark - Execution
+
+    void compile();
+
+    // Records the live passes, with their barriers, into the command
+    // buffer, which must be the frame's (e.g. from Renderer::beginFrame()).
+    void execute(vk::CommandBuffer commandBuffer);
+
+    vk::Image          getImage(FrameGraphImage image) const;
+    vk::ImageView      getImageView(FrameGraphImage image) const;
+    TransientImageDesc getImageDesc(FrameGraphImage image) const;
+
+    const FrameGraphStatistics &getStatistics() const { return statistics; }
+};
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif // VKMOL_RENDERER_FRAMEGRAPH_H
@@ -0,0 +1,137 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_HOSTALLOCATOR_H
+#define VKMOL_RENDERER_HOSTALLOCATOR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+namespace vkmol {
+namespace renderer {
+
+struct HostAllocationStatistics {
+    struct Scope {
+        uint64_t allocations    = 0;
+        uint64_t reallocations  = 0;
+        uint64_t frees          = 0;
+        uint64_t liveBytes      = 0;
+        uint64_t peakLiveBytes  = 0;
+        uint64_t totalBytes     = 0;
+        uint64_t arenaAllocations = 0;
+    };
+
+    // Indexed by VkSystemAllocationScope.
+    std::array<Scope, 5> scopes;
+
+    // Reported by the driver through the internal allocation notifications,
+    // i.e. memory it allocated for itself without asking us.
+    uint64_t internalLiveBytes = 0;
+};
+
+/*
+ * Host allocation callbacks for the Vulkan driver (and VMA) which count
+ * calls and bytes per VkSystemAllocationScope.
+ *
+ * Command scope allocations only live for the duration of one Vulkan call,
+ * so they come from a small per-thread bump arena that is rewound whenever
+ * it has nothing live, rather than from malloc.
+ *
+ * The driver may call in from any thread; the counters are atomic.
+ */
+class HostAllocator {
+private:
+    struct Counters {
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> reallocations{0};
+        std::atomic<uint64_t> frees{0};
+        std::atomic<uint64_t> liveBytes{0};
+        std::atomic<uint64_t> peakLiveBytes{0};
+        std::atomic<uint64_t> totalBytes{0};
+        std::atomic<uint64_t> arenaAllocations{0};
+    };
+
+    std::array<Counters, 5> counters;
+    std::atomic<uint64_t>   internalLiveBytes{0};
+
+    vk::AllocationCallbacks callbacks;
+
+    void *allocate(size_t                  size,
+                   size_t                  alignment,
+                   VkSystemAllocationScope scope);
+    void *reallocate(void *original, size_t size, size_t alignment,
+                     VkSystemAllocationScope scope);
+    void  free(void *memory);
+
+    void countAllocation(VkSystemAllocationScope scope, size_t size);
+    void countFree(VkSystemAllocationScope scope, size_t size);
+
+    static void *VKAPI_PTR allocationFunction(void *                  userData,
+                                              size_t                  size,
+                                              size_t                  alignment,
+                                              VkSystemAllocationScope scope);
+    static void *VKAPI_PTR
+                     reallocationFunction(void *                  userData,
+                                          void *                  original,
+                                          size_t                  size,
+                                          size_t                  alignment,
+                                          VkSystemAllocationScope scope);
+    static void VKAPI_PTR freeFunction(void *userData, void *memory);
+    static void VKAPI_PTR
+    internalAllocationNotification(void *                   userData,
+                                   size_t                   size,
+                                   VkInternalAllocationType type,
+                                   VkSystemAllocationScope  scope);
+    static void VKAPI_PTR
+                internalFreeNotification(void *                   userData,
+                                         size_t                   size,
+                                         VkInternalAllocationType type,
+                                         VkSystemAllocationScope  scope);
+
+public:
+#pragma mark - Lifecycle
+
+    HostAllocator();
+
+    HostAllocator(const HostAllocator &) = delete;
+    HostAllocator &operator=(const HostAllocator &) = delete;
+
+    HostAllocator(HostAllocator &&) = delete;
+    HostAllocator &operator=(HostAllocator &&) = delete;
+
+    ~HostAllocator() = default;
+
+#pragma mark - Operations
+
+    const vk::AllocationCallbacks *getCallbacks() const { return &callbacks; }
+
+    HostAllocationStatistics getStatistics() const;
+};
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif // VKMOL_RENDERER_HOSTALLOCATOR_H
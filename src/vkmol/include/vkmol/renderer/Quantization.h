@@ -0,0 +1,84 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_QUANTIZATION_H
+#define VKMOL_RENDERER_QUANTIZATION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+namespace vkmol {
+namespace renderer {
+
+/*
+ * Compact vertex encoding for display: positions as 16 bit fixed point
+ * within a bounding box (a chain's, say), normals octahedral-encoded into
+ * two 16 bit components. 12 bytes a vertex instead of 24.
+ *
+ * The formats are normalized, so the vertex fetch already yields [0, 1]
+ * positions and [-1, 1] octahedral coordinates e. What remains for the
+ * vertex shader is
+ *
+ *   position = origin + extent * position.xyz
+ *   n        = vec3(e, 1 - |e.x| - |e.y|)
+ *   n.xy     = (1 - |n.yx|) * sign(n.xy), where n.z < 0 and sign(0) = 1
+ *   normal   = normalize(n)
+ *
+ * which shaders/quantized.vert does, with the bounds as push constants laid
+ * out like QuantizationBounds (float arrays, not vec3, to match its packing).
+ */
+struct QuantizedVertex {
+    uint16_t position[4]; // xyz, and padding to keep normal aligned
+    int16_t  normal[2];
+
+    static constexpr vk::Format positionFormat = vk::Format::eR16G16B16A16Unorm;
+    static constexpr vk::Format normalFormat   = vk::Format::eR16G16Snorm;
+};
+
+static_assert(sizeof(QuantizedVertex) == 12, "QuantizedVertex is packed");
+
+// Positions decode as origin + extent * position. Pass both to the shader.
+struct QuantizationBounds {
+    float origin[3] = {0.0f, 0.0f, 0.0f};
+    float extent[3] = {1.0f, 1.0f, 1.0f};
+};
+
+// Bounding box of count xyz positions. Zero extents, along flat axes, are
+// widened by a small fraction of the coordinate so that encoding stays
+// finite.
+QuantizationBounds computeQuantizationBounds(const float *positions,
+                                             size_t       count);
+
+// positions and normals hold count xyz triples; normals may be null, in
+// which case the encoded normals are zero. Normals need not be normalized.
+void quantizeVertices(const float *             positions,
+                      const float *             normals,
+                      size_t                    count,
+                      const QuantizationBounds &bounds,
+                      QuantizedVertex *         out);
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif // VKMOL_RENDERER_QUANTIZATION_H
@@ -24,12 +24,28 @@
 #define VKMOL_RENDERER_RENDERER_H
 
 #include "Buffer.h"
+#include "Frame.h"
+#include "FrameGraph.h"
+#include "HostAllocator.h"
+#include "Quantization.h"
 #include "Resource.h"
 #include "Swapchain.h"
+#include "ThreadPool.h"
 #include "UploadOp.h"
+#include "VirtualBlock.h"
+#include "WorkerContext.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <vulkan/vulkan.hpp>
 
@@ -60,6 +76,53 @@ struct RendererWSIDelegate {
 
     std::function<std::tuple<int, int>()> getWindowSize;
     std::function<std::tuple<int, int>()> getFramebufferSize;
+
+    // Optional. When rendering on demand, called as a frame becomes needed,
+    // from whichever thread invalidated it, to wake an event loop waiting
+    // for input, e.g. with glfwPostEmptyEvent().
+    std::function<void()> wake;
+};
+
+struct MemoryStatistics {
+    // Bytes held by live buffers, indexed by BufferType.
+    std::array<size_t, 5> bufferBytes = {};
+
+    // Per memory heap. These come from VK_EXT_memory_budget when the device
+    // has it, and otherwise from VMA's statistics and the heap sizes.
+    std::vector<size_t> heapUsage;
+    std::vector<size_t> heapBudget;
+    bool                budgetExtension = false;
+
+    // Bytes of geometry given up to stay within budget, over the lifetime
+    // of the renderer.
+    size_t evictedBytes = 0;
+
+    // Bytes of streamed buffers still to be uploaded.
+    size_t streamingBytes = 0;
+
+    // Whether buffer contents are written straight into device local memory
+    // rather than staged, see RendererInfo::directBufferWrites.
+    bool directBufferWrites = false;
+};
+
+struct FrameStatistics {
+    // Over the last frames begun, in milliseconds from one beginFrame() to
+    // the next. Percentiles are nearest rank.
+    uint32_t frames = 0;
+    float    mean   = 0.0f;
+    float    median = 0.0f;
+    float    p90    = 0.0f;
+    float    p99    = 0.0f;
+    float    max    = 0.0f;
+
+    // The present mode in use, which may not be the one asked for.
+    PresentMode presentMode = PresentMode::Fifo;
+
+    // The GPU time of the last frame synced, in milliseconds, from
+    // timestamps around its command buffer; zero if the device has none.
+    // And the resolution scale of the frame being recorded.
+    float gpuFrameTime    = 0.0f;
+    float resolutionScale = 1.0f;
 };
 
 struct RendererInfo {
@@ -68,6 +131,69 @@ struct RendererInfo {
 
     size_t ringBufferSize = 1048576; // 1MiB
 
+    // When non-zero, vertex and index buffers no larger than this are
+    // sub-allocated from shared backing buffers of this size, rather than
+    // each getting a vk::Buffer and allocation of their own.
+    size_t bufferPoolBlockSize = 0;
+
+    // Bytes of buffer memory to stay within by evicting least recently used
+    // evictable buffers. Zero means no limit of our own, although the limit
+    // reported by VK_EXT_memory_budget is still respected.
+    size_t memoryBudget = 0;
+
+    // Write buffer contents straight into device local memory when the
+    // device has host visible device local memory to spare (integrated and
+    // software devices, resizable BAR), instead of copying them from a
+    // staging buffer. Devices without it always stage.
+    bool directBufferWrites = true;
+
+    // Buffers at least this large that are not written directly or pooled
+    // are uploaded on the transfer queue, off the graphics queue's critical
+    // path. Zero sends everything through the per-frame copy batch.
+    uint32_t asyncUploadThreshold = 1048576; // 1MiB
+
+    // Persistently mapped staging memory shared by asynchronous uploads.
+    // Uploads that do not fit in what is free of it are sub-allocated from
+    // persistent overflow blocks, up to as much again, and only past that
+    // get a staging allocation of their own.
+    size_t stagingRingSize = 16777216; // 16MiB
+
+    // Bytes of streamed buffer contents sent to the GPU per frame, see
+    // Renderer::streamBuffer().
+    size_t uploadBytesPerFrame = 16777216; // 16MiB
+
+    // Time and bytes per frame spent moving buffers out of sparsely used
+    // pool blocks and VMA blocks, so that those blocks can be released.
+    // Moves are invisible to handle holders. Zero time disables
+    // defragmentation.
+    unsigned int defragmentationMicroseconds  = 0;
+    size_t       defragmentationBytesPerFrame = 8388608; // 8MiB
+
+    // Frames the CPU may record ahead of the GPU, counting the one being
+    // recorded. Zero means swapchainInfo.imageCount.
+    unsigned int framesInFlight = 0;
+
+    // Threads recordParallel() uses besides the calling one. Zero means one
+    // per remaining hardware thread.
+    unsigned int recordingThreads = 0;
+
+    // Only record and present frames once something has invalidated the
+    // last one, see Renderer::needsFrame(), so that a static scene costs
+    // next to nothing.
+    bool renderOnDemand = false;
+
+    // Dynamic resolution: while interactive (see Renderer::setInteractive())
+    // the scene is rendered at whatever scale of the swapchain's resolution,
+    // within the limits, keeps the GPU frame time at this many
+    // milliseconds. Zero renders at the maximum scale throughout.
+    float targetFrameTime    = 0.0f;
+    float minResolutionScale = 0.5f;
+    float maxResolutionScale = 1.0f;
+
+    // Route the driver's (and VMA's) host allocations through counting
+    // callbacks, see getHostAllocationStatistics().
+    bool instrumentHostAllocations = false;
+
     SwapchainInfo swapchainInfo;
 
     std::string               appName    = "Untitled App";
@@ -77,12 +203,67 @@ struct RendererInfo {
 
 typedef ResourceHandle<Buffer> BufferHandle;
 
+struct BufferDesc {
+    BufferType  type     = BufferType::Invalid;
+    uint32_t    size     = 0;
+    const void *contents = nullptr;
+};
+
+// Called when a buffer is evicted. The handle is stale by then; the owner
+// is expected to regenerate the contents if and when they are needed again.
+typedef std::function<void(BufferHandle)> EvictionCallback;
+
+// Streamed buffers are uploaded in this order, first come first served
+// within each class.
+enum class UploadPriority : uint8_t { Visible, Default, Prefetch };
+
+// Called as each frame's part of a streamed buffer goes out, with the bytes
+// sent so far. Once uploaded == total the buffer may be used from the next
+// frame on.
+typedef std::function<void(BufferHandle, uint32_t uploaded, uint32_t total)>
+    UploadProgressCallback;
+
+// Records items [begin, end) of a draw list into the command buffer. Called
+// concurrently from several threads, so it must not touch the Renderer or
+// anything else shared without synchronization, and must not throw.
+typedef std::function<
+    void(vk::CommandBuffer commandBuffer, uint32_t begin, uint32_t end)>
+    RecordCallback;
+
 class Renderer {
 private:
-    // todo: std::vector<Frame> frames;
+    // Creates transient images, and waits for frames, with the renderer's
+    // device and allocator.
+    friend class FrameGraph;
+
+    // A ring of frames, indexed by frame number modulo its size.
+    std::vector<Frame> frames;
+
+    // Records the chunks of recordParallel(), which are executed in order.
+    std::unique_ptr<ThreadPool>    recordingPool;
+    std::vector<vk::CommandBuffer> parallelCommandBuffers;
+
+    // VK_KHR_timeline_semaphore. Frame n signals frameTimeline to n, and the
+    // n'th upload op signals uploadTimeline to n, so whether work has
+    // completed comes down to comparing against a counter. Without it,
+    // frames signal their fence and upload ops a semaphore of their own.
+    bool          timelineSemaphores = false;
+    vk::Semaphore frameTimeline;
+    vk::Semaphore uploadTimeline;
+    uint64_t      uploadsSubmitted = 0;
+#ifdef VK_KHR_timeline_semaphore
+    PFN_vkGetSemaphoreCounterValueKHR pfn_vkGetSemaphoreCounterValueKHR =
+        nullptr;
+    PFN_vkWaitSemaphoresKHR pfn_vkWaitSemaphoresKHR = nullptr;
+#endif
 
     RendererWSIDelegate delegate;
 
+    // Null unless instrumentHostAllocations was set, as are the callbacks
+    // passed to every create and destroy call.
+    std::unique_ptr<HostAllocator> hostAllocator;
+    const vk::AllocationCallbacks *allocationCallbacks = nullptr;
+
     ResourceContainer<Buffer> buffers;
     // todo: ... other resource containers
 
@@ -97,17 +278,34 @@ private:
     uint32_t                           graphicsQueueIndex = 0;
     uint32_t                           transferQueueIndex = 0;
 
+    // Memory types buffers are allocated from when contents are written
+    // directly, or zero if they are staged.
+    uint32_t directWriteMemoryTypes = 0;
+
+    // VK_EXT_external_memory_host, for staging straight out of mapped files.
+    bool           hostMemoryImport     = false;
+    vk::DeviceSize hostPointerAlignment = 0;
+#ifdef VK_EXT_external_memory_host
+    PFN_vkGetMemoryHostPointerPropertiesEXT
+        pfn_vkGetMemoryHostPointerPropertiesEXT = nullptr;
+#endif
+
     std::unordered_set<vk::Format>         surfaceFormats;
     vk::SurfaceCapabilitiesKHR             surfaceCapabilities;
     std::unordered_set<vk::PresentModeKHR> surfacePresentModes;
     vk::SwapchainKHR                       swapchain;
+    vk::Format                             swapchainFormat;
+    vk::Extent2D                           swapchainExtent;
+    std::vector<vk::Image>                 swapchainImages;
+    std::vector<vk::ImageView>             swapchainImageViews;
+
+    // Whether swapchain images may be blitted into, which upscale() needs.
+    // Not every surface supports it.
+    bool swapchainTransferDestination = false;
     // vk::PipelineCache                      pipelineCache;
     vk::Queue graphicsQueue;
     vk::Queue transferQueue;
 
-    vk::Semaphore acquireSemaphore;
-    vk::Semaphore finishedSemaphore;
-
     VmaAllocator  allocator        = nullptr;
     VmaAllocation ringBufferMemory = nullptr;
     vk::Buffer    ringBuffer;
@@ -115,18 +313,177 @@ private:
     size_t        ringBufferOffset  = 0;
     uint8_t *     persistentMapping = nullptr;
 
+    // Ring buffer offsets only ever increase; the position within the ring
+    // is the offset modulo ringBufferSize. This makes the space still in use
+    // by the GPU simply ringBufferOffset - lastSyncedRingBufferIndex.
+
     // Synchronized up to this ringbuffer index (bookkeeping).
-    uint32_t lastSyncedRingBufferIndex;
+    size_t lastSyncedRingBufferIndex = 0;
+
+    // Ring allocations handed out this frame, released when it is recorded.
+    std::vector<ResourceHandle<Buffer>> ephemeralBuffers;
+
+    // Large backing buffers that pooled buffers are carved out of. A pooled
+    // Buffer refers to its block's vk::Buffer, at its own offset.
+    struct BufferPool {
+        struct Block {
+            vk::Buffer    buffer;
+            VmaAllocation memory  = nullptr;
+            uint8_t *     mapping = nullptr;
+            VirtualBlock  allocator;
+        };
+
+        std::vector<Block> blocks;
+
+        // The block being emptied by defragmentation, if any. Nothing new
+        // is allocated from it.
+        vk::Buffer evacuating;
+    };
+
+    size_t     bufferPoolBlockSize = 0;
+    BufferPool vertexPool;
+    BufferPool indexPool;
+
+    unsigned int defragmentationMicroseconds  = 0;
+    size_t       defragmentationBytesPerFrame = 0;
+
+    // The VMA block being emptied of buffers that are not pooled, if any,
+    // and whether such a buffer has been freed since the last look for one.
+    VkDeviceMemory evacuatingMemory = VK_NULL_HANDLE;
+    bool           dedicatedFreed   = false;
+
+    // Staging for the main thread's createBuffer() calls; worker threads
+    // bring their own.
+    WorkerContext                               mainContext;
+    std::mutex                                  workerContextsMutex;
+    std::vector<std::unique_ptr<WorkerContext>> workerContexts;
 
     // The command pool for transfers is persistent, whereas we otherwise
-    // use a distinct ephemeral command pool per frame.
+    // use the frame's command pool.
     vk::CommandPool transferCommandPool;
-    //    std::vector<UploadOp> uploads;
+    uint32_t        asyncUploadThreshold = 0;
+
+    // Submitted on the transfer queue. The next copy batch waits for them
+    // and acquires what they wrote for the graphics queue.
+    std::vector<UploadOp> uploads;
+
+    // Waited for by the copy batch of frame, and freed once it is synced.
+    struct AcquiredUpload {
+        uint32_t frame = 0;
+        UploadOp op;
+    };
+
+    std::vector<AcquiredUpload> acquiredUploads;
+
+    // Ready to be reused, command buffer and semaphore included.
+    std::vector<UploadOp> freeUploadOps;
+
+    // Copies out of staging collected over a frame, for the copy batch and
+    // for the frame's one transfer queue submission respectively. They are
+    // recorded grouped, one vkCmdCopyBuffer per source and destination.
+    struct UploadCopy {
+        vk::Buffer      source;
+        vk::Buffer      destination;
+        vk::BufferCopy  region;
+        vk::AccessFlags access;
+
+        // For copies made before the frame's defragmentation step, which
+        // may move the buffer. The destination is looked up when the copy
+        // is recorded, and region.dstOffset is relative to the buffer.
+        BufferHandle handle;
+    };
+
+    std::vector<UploadCopy>     stagedCopies;
+    std::vector<UploadCopy>     uploadCopies;
+    std::vector<vk::BufferCopy> copyRegions;
+
+    // Partial updates made during a frame, waiting in the ring buffer. They
+    // are merged per destination before going into stagedCopies.
+    struct BufferUpdate {
+        BufferHandle handle;
+        vk::Buffer   source;
+        uint32_t     sourceOffset = 0;
+        uint32_t     offset       = 0;
+        uint32_t     size         = 0;
+    };
+
+    // Scratch space for encoding QuantizedVertex updates.
+    std::vector<QuantizedVertex> quantizedScratch;
+
+    std::vector<BufferUpdate>    bufferUpdates;
+    std::vector<UploadCopy>      updateCopies;
+    std::map<uint32_t, uint32_t> updatedRanges;
+
+    // Buffers being filled a slice per frame, one queue per UploadPriority.
+    struct Stream {
+        BufferHandle           handle;
+        const uint8_t *        contents = nullptr;
+        uint8_t *              mapping  = nullptr;
+        uint32_t               size     = 0;
+        uint32_t               uploaded = 0;
+        UploadProgressCallback onProgress;
+    };
+
+    struct StreamProgress {
+        BufferHandle           handle;
+        uint32_t               uploaded = 0;
+        uint32_t               total    = 0;
+        UploadProgressCallback onProgress;
+    };
+
+    size_t                            uploadBytesPerFrame = 0;
+    std::array<std::deque<Stream>, 3> streams;
+    std::vector<StreamProgress>       streamProgress;
+
+    // Mapped files imported as staging memory by createBufferFromFile(),
+    // unmapped once the frame that copied out of them is synced.
+    struct ImportedFile {
+        uint32_t         frame = 0;
+        vk::Buffer       buffer;
+        vk::DeviceMemory memory;
+        void *           mapping = nullptr;
+        size_t           length  = 0;
+    };
+
+    std::vector<ImportedFile> importedFiles;
+
+    // Works like the ring buffer above, except that it does not grow.
+    struct StagingRing {
+        Buffer              buffer;
+        uint8_t *           mapping = nullptr;
+        size_t              offset  = 0;
+        size_t              synced  = 0;
+
+        // Taken when the ring is full. Each block is filled linearly and
+        // starts over once the last frame that used it is synced.
+        struct Overflow {
+            Buffer   buffer;
+            uint8_t *mapping = nullptr;
+            uint32_t used    = 0;
+            uint32_t frame   = 0;
+        };
+
+        std::vector<Overflow> overflow;
+    };
+
+    StagingRing stagingRing;
 
     bool debugMarkers = false;
 
-    // These resources are cleaned out every frame.
-    std::unordered_set<Resource> graveyard;
+    struct EvictableBuffer {
+        BufferHandle     handle;
+        EvictionCallback onEvict;
+    };
+
+    size_t memoryBudget          = 0;
+    bool   memoryBudgetExtension = false;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR
+        pfn_vkGetPhysicalDeviceMemoryProperties2KHR = nullptr;
+
+    std::array<size_t, 5>        bufferBytes    = {};
+    size_t                       graveyardBytes = 0;
+    size_t                       evictedBytes   = 0;
+    std::vector<EvictableBuffer> evictableBuffers;
 
     SwapchainInfo swapchainInfo;
     SwapchainInfo wantedSwapchainInfo;
@@ -134,7 +491,38 @@ private:
 
     std::tuple<unsigned int, unsigned int> framebufferSize;
 
-    uint32_t currentFrame    = 0;
+    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+
+    // Set from any thread by invalidate(), and cleared as a frame begins.
+    bool              renderOnDemand = false;
+    std::atomic<bool> invalidated{true};
+
+    // A ring of the most recent frame times, in milliseconds.
+    std::chrono::steady_clock::time_point lastFrameBegin;
+    std::vector<float>                    frameTimes;
+    size_t                                frameTimeCount = 0;
+
+    // Two timestamps per frame slot, written at the start and end of the
+    // frame's command buffer. Null if the graphics queue has no timestamps.
+    vk::QueryPool timestampPool;
+    uint32_t      timestampValidBits = 0;
+    float         timestampPeriod    = 0.0f;
+
+    // The GPU time of the last frame synced, and the scale it was rendered
+    // at. Fresh until the resolution scale has been adjusted for it.
+    float gpuFrameTime      = 0.0f;
+    float gpuFrameScale     = 1.0f;
+    bool  gpuFrameTimeFresh = false;
+
+    float        targetFrameTime    = 0.0f;
+    float        minResolutionScale = 1.0f;
+    float        maxResolutionScale = 1.0f;
+    float        resolutionScale    = 1.0f;
+    bool         interactive        = false;
+    vk::Extent2D renderExtent;
+
+    // Frame 0 is never recorded, so it is trivially synced.
+    uint32_t currentFrame    = 1;
     uint32_t lastSyncedFrame = 0;
 
     unsigned long uboAlignment  = 0;
@@ -157,22 +545,122 @@ private:
         ~ResourceDeleter() = default;
 
         void operator()(Buffer &b) const { renderer->deleteBufferInternal(b); }
+
+        void operator()(RetiredSwapchain &s) const {
+            renderer->deleteSwapchainInternal(s);
+        }
     };
 
-    void         recreateSwapchain();
+    void retireResource(Resource &&r);
+    void collectGraveyard();
+
+    // Returns false if there is nothing to present to, e.g. while the
+    // window is minimized, in which case the swapchain stays dirty.
+    bool         recreateSwapchain();
+    vk::Format   chooseSurfaceFormat() const;
+    bool         acquireImage(Frame &frame);
     void         recreateRingBuffer(unsigned int newSize);
-    unsigned int ringBufferAllocate(unsigned int size, unsigned int alignPower);
+    unsigned int ringBufferAllocate(unsigned int size, unsigned int alignment);
+    unsigned int bufferAlignment(BufferType type) const;
+
+    // These return where to write the buffer's contents if its memory is
+    // host visible, and null if it has to be staged.
+    uint8_t *allocateDedicatedBuffer(Buffer &b, BufferType type, uint32_t size);
+
+    BufferPool &bufferPool(BufferType type);
+    uint8_t *   allocatePooledBuffer(Buffer &b, BufferType type, uint32_t size);
+    void        freePooledBuffer(Buffer &b);
+    void        destroyBufferPool(BufferPool &pool);
+
+    bool isPooled(BufferType type, uint32_t size) const;
+
+    // Buffer copies made while recording a frame (defragmentation moves,
+    // staged contents) go into the frame's copy batch.
+    vk::CommandBuffer copyBatch();
+    void              submitFrame();
+
+    void chooseEvacuationBlock(BufferPool &pool);
+    void chooseEvacuationMemory();
+    void defragmentStep();
 
-    UploadOp allocateUploadOp(uint32_t size);
+    Buffer createStagingBuffer(uint32_t size, uint8_t **mapping);
+    void   reserveStaging(WorkerContext &context, uint32_t size);
+    void   stage(WorkerContext &         context,
+                 WorkerContext::Pending &pending,
+                 const void *            contents);
+    void   flushWorkerContext(WorkerContext &context);
+    void   flushWorkerContexts();
+    void   destroyWorkerContext(WorkerContext &context);
+
+    Frame &recordingFrame() { return frames[currentFrame % frames.size()]; }
+
+    // Waits for the frame last recorded into the current frame's slot,
+    // unless it has already been synced, and makes the slot ready to record.
+    void claimFrame();
+    void pollFrames();
+
+    vk::CommandBuffer secondaryCommandBuffer(Frame::ThreadCommands &commands);
+
+    vk::Semaphore createTimelineSemaphore();
+    uint64_t      timelineValue(vk::Semaphore timeline) const;
+    void          waitForFrame(uint32_t frame);
+
+    vk::PresentModeKHR choosePresentMode(PresentMode mode) const;
+    void               paceFrame();
+
+    void readGpuFrameTime(Frame &frame);
+    void updateResolutionScale();
+
+    void markFrameRecorded();
+    void markFrameSynced(uint32_t frame);
+
+    typedef std::array<size_t, VK_MAX_MEMORY_HEAPS> HeapSizes;
+
+    void queryHeapBudgets(HeapSizes &usage, HeapSizes &budget) const;
+    void enforceMemoryBudget();
+
+    // The op comes with its command buffer recording. Fill in the copies,
+    // out of staging from stageUpload(), and the acquire barriers for the
+    // graphics queue, then submit it; the release barriers are derived from
+    // the acquire barriers.
+    UploadOp allocateUploadOp();
     void     submitUploadOp(UploadOp &&op);
+    void     acquireUploads(vk::CommandBuffer commandBuffer);
+    void     recycleUploadOp(UploadOp &op);
+    void     freeUploadOp(UploadOp &op);
+    bool     stagingRingAllocate(uint32_t size, uint32_t &offset);
+
+    // Returns where to write, or null if there is no overflow block room.
+    uint8_t *stagingOverflowAllocate(uint32_t    size,
+                                     vk::Buffer &buffer,
+                                     uint32_t &  offset);
+
+    // Returns false, having done nothing, if b should be staged instead.
+    // Otherwise the copy goes out with the frame's submitUploads().
+    bool uploadAsync(Buffer &b, const void *contents);
+    void stageUpload(Buffer &b, uint32_t offset, const void *contents,
+                     uint32_t size);
+    void streamUploads();
+
+    // Wraps host memory in a transfer source buffer, if the device can.
+    bool importHostMemory(void *            mapping,
+                          size_t            length,
+                          vk::Buffer &      buffer,
+                          vk::DeviceMemory &memory);
+    void submitUploads();
+    void flushBufferUpdates();
+    void mergeBufferUpdates(const UploadCopy *begin, const UploadCopy *end);
+    void recordCopies(vk::CommandBuffer        commandBuffer,
+                      std::vector<UploadCopy> &copies);
 
     void deleteBufferInternal(Buffer &b);
+    void deleteSwapchainInternal(RetiredSwapchain &s);
+    void deleteResourceInternal(Resource &r);
 
     // TODO: implement delete internals
     //    void deleteFramebufferInternal(Framebuffer &fb);
     //    void deleteRenderPassInternal(RenderPass &rp);
     //    void deleteRenderTargetInternal(RenderTarget &rt);
-    //    void deleteResourceInternal(Resource &r);
     //    void deleteSamplerInternal(Sampler &s);
     //    void deleteTextureInternal(Texture &tex);
     //    void deleteFrameInternal(Frame &f);
@@ -186,12 +674,105 @@ public:
 
     Renderer &operator=(const Renderer &) = delete;
 
-    Renderer(Renderer &&other) = default;
+    Renderer(Renderer &&) = delete;
 
-    Renderer &operator=(Renderer &&other) = default;
+    Renderer &operator=(Renderer &&) = delete;
 
     ~Renderer();
 
+#pragma mark - Frames
+
+    // Returns the command buffer to record the frame's graphics work into,
+    // which is submitted by endFrame(). The swapchain image, if any, is
+    // acquired here. Frames up to RendererInfo::framesInFlight - 1 behind
+    // may still be executing on the GPU.
+    vk::CommandBuffer beginFrame();
+    void              endFrame();
+
+    // Splits items [0, count) into chunks recorded into secondary command
+    // buffers on the recording threads (this one included), then executes
+    // them in order in the frame's command buffer. For the chunks to be
+    // recorded inside a render pass, set inheritance's render pass and
+    // subpass, and begin the pass with eSecondaryCommandBuffers.
+    void recordParallel(uint32_t                                count,
+                        const vk::CommandBufferInheritanceInfo &inheritance,
+                        const RecordCallback &                  record);
+
+    // See SwapchainInfo. Queueing and pacing apply from the next frame, a
+    // new present mode once the swapchain has been recreated for it.
+    void setPresentPolicy(PresentMode  presentMode,
+                          unsigned int maxQueuedFrames,
+                          unsigned int frameRateLimit);
+
+    FrameStatistics getFrameStatistics() const;
+
+    // Call when the scene or camera has changed, when rendering on demand.
+    // May be called from any thread.
+    void invalidate();
+
+    // Whether to record a frame now: always, unless rendering on demand,
+    // in which case only once the last frame has been invalidated, by
+    // invalidate(), a resize, the camera coming to rest at a reduced
+    // resolution scale, or streamed contents arriving, or while created,
+    // updated or deleted buffers wait for a frame to go out with. Otherwise
+    // wait for input, or for the delegate's wake(), before asking again.
+    bool needsFrame();
+
+#pragma mark - Swapchain
+
+    // Call when the window's framebuffer is resized; some platforms never
+    // report the swapchain as out of date. It is recreated at the next
+    // beginFrame(), without waiting for the frames in flight.
+    void framebufferResized();
+
+    // Attachments sized after these need only be rebuilt when they change,
+    // e.g. by importing the image into a FrameGraph every frame.
+    vk::Extent2D getSwapchainExtent() const { return swapchainExtent; }
+    vk::Format   getSwapchainFormat() const { return swapchainFormat; }
+
+    // The image acquired for the frame being recorded, or null if none
+    // was, e.g. because the window is minimized.
+    vk::Image     getSwapchainImage() const;
+    vk::ImageView getSwapchainImageView() const;
+
+    // Whether swapchain images can be written by transfers, e.g. cleared
+    // or blitted into; not every surface allows it.
+    bool canTransferToSwapchain() const {
+        return swapchainTransferDestination;
+    }
+
+#pragma mark - Dynamic Resolution
+
+    // E.g. while the camera moves. Only then does the resolution scale
+    // follow the GPU frame time; otherwise the scene is rendered at the
+    // maximum scale, from the next frame on.
+    void setInteractive(bool interactive);
+
+    // False if the surface does not let swapchain images be blitted into.
+    // The scene is then rendered at the swapchain's resolution, straight
+    // into the swapchain image, whatever the scale limits.
+    bool canUpscale() const { return swapchainTransferDestination; }
+
+    // What to create the scene's render target at: the swapchain extent at
+    // the maximum scale. Scale changes leave it be, so the target is not
+    // reallocated as the scale moves, only when the swapchain is.
+    vk::Extent2D getRenderTargetExtent() const;
+
+    // The region of the render target, from its origin, to render the
+    // frame into; set the viewport and scissor to it. Fixed from
+    // beginFrame() to endFrame().
+    vk::Extent2D getRenderExtent() const { return renderExtent; }
+
+    // Blits the frame's region of source over the whole of destination,
+    // with linear filtering. source must be in eTransferSrcOptimal, and
+    // destination (e.g. the swapchain image) in eTransferDstOptimal; in a
+    // FrameGraph, from a pass reading the render target as TransferSource
+    // and writing the swapchain image as TransferDestination. Only if
+    // canUpscale().
+    void upscale(vk::CommandBuffer commandBuffer,
+                 vk::Image         source,
+                 vk::Image         destination) const;
+
 #pragma mark - Resource Management
 
     //    RenderTargetHandle   createRenderTarget(const RenderTargetDesc &desc);
@@ -203,12 +784,110 @@ public:
     //    createPipeline(const PipelineDesc &desc);
     BufferHandle
     createBuffer(BufferType type, uint32_t size, const void *contents);
-    //    BufferHandle         createEphemeralBuffer(BufferType type, uint32_t
-    //    size, const void *contents); SamplerHandle        createSampler(const
-    //    SamplerDesc &desc); TextureHandle        createTexture(const
-    //    TextureDesc &desc);
+
+    // Creates many buffers with one staging allocation, and their contents
+    // go out in the same copy batch. Handles are returned in order.
+    std::vector<BufferHandle>
+    createBuffers(const std::vector<BufferDesc> &descs);
+
+    // Ephemeral buffers live in the ring buffer and are only valid for the
+    // frame currently being recorded. They need not (and must not) be
+    // deleted.
+    BufferHandle
+    createEphemeralBuffer(BufferType type, uint32_t size, const void *contents);
+    //    SamplerHandle        createSampler(const SamplerDesc &desc);
+    //    TextureHandle        createTexture(const TextureDesc &desc);
 
     void deleteBuffer(BufferHandle handle);
+
+    // Overwrites size bytes of the buffer's contents at offset, as of the
+    // next frame submitted. data is copied right away. Updates within a
+    // frame are merged, with later ones winning where they overlap, and
+    // only the ranges touched are copied, in the frame's copy batch.
+    void updateBuffer(BufferHandle handle,
+                      uint32_t     offset,
+                      uint32_t     size,
+                      const void * data);
+
+#pragma mark - Quantized Vertices
+
+    // Vertex buffers of QuantizedVertex, for half the memory and upload
+    // bandwidth of float positions and normals; see Quantization.h for the
+    // encoding and decoding. normals may be null.
+    BufferHandle
+    createQuantizedVertexBuffer(const float *             positions,
+                                const float *             normals,
+                                uint32_t                  count,
+                                const QuantizationBounds &bounds);
+
+    // E.g. for the next frame of a trajectory. The bounds must be those the
+    // buffer was created with, or the old vertices decode wrongly.
+    void updateQuantizedVertexBuffer(BufferHandle              handle,
+                                     uint32_t                  first,
+                                     const float *             positions,
+                                     const float *             normals,
+                                     uint32_t                  count,
+                                     const QuantizationBounds &bounds);
+
+#pragma mark - Streaming
+
+    // Creates the buffer right away, but uploads its contents over as many
+    // frames as RendererInfo::uploadBytesPerFrame requires, ahead of lower
+    // priority streams. contents must stay valid until the upload completes
+    // or the buffer is deleted, and the buffer must not be used before it
+    // completes.
+    BufferHandle streamBuffer(BufferType             type,
+                              uint32_t               size,
+                              const void *           contents,
+                              UploadPriority         priority,
+                              UploadProgressCallback onProgress = nullptr);
+
+    // E.g. to promote prefetched data the camera has come upon. Does
+    // nothing if the buffer has finished uploading.
+    void setUploadPriority(BufferHandle handle, UploadPriority priority);
+
+    // Creates a buffer from size bytes of the file at path, starting at
+    // offset; a size of zero means the rest of the file. The file is mapped
+    // rather than read, and where the device supports it the mapping itself
+    // is the staging memory, so the contents are never copied on the host.
+    BufferHandle createBufferFromFile(BufferType         type,
+                                      const std::string &path,
+                                      size_t             offset = 0,
+                                      size_t             size   = 0);
+
+#pragma mark - Worker Threads
+
+    // Every thread other than the one rendering that wants to create
+    // buffers needs a context of its own. The renderer owns it; it stays
+    // valid for the renderer's lifetime.
+    WorkerContext &createWorkerContext();
+
+    // May be called from the thread owning the context while the renderer
+    // is in use elsewhere. The buffer is only committed once the frame
+    // being recorded ends, so the handle may be passed on right away but
+    // must not be used for anything (drawing, deleteBuffer(),
+    // updateBuffer(), markBufferUsed(), ...) until after the next
+    // endFrame().
+    BufferHandle createBuffer(WorkerContext &context,
+                              BufferType     type,
+                              uint32_t       size,
+                              const void *   contents);
+
+#pragma mark - Memory Budget
+
+    // Records that the buffer is needed by the frame being recorded, which
+    // protects it from eviction and informs the LRU order.
+    void markBufferUsed(BufferHandle handle);
+
+    // Allows the buffer to be deleted when over budget. Only buffers whose
+    // contents can be regenerated should be made evictable.
+    void setBufferEvictable(BufferHandle handle, EvictionCallback onEvict);
+
+    // Walks every allocation, so this is for diagnostics, not every frame.
+    MemoryStatistics getMemoryStatistics() const;
+
+    // All zero unless instrumentHostAllocations was set.
+    HostAllocationStatistics getHostAllocationStatistics() const;
 //    void deleteFramebuffer(FramebufferHandle fbo);
 //    void deleteRenderPass(RenderPassHandle fbo);
 //    void deleteSampler(SamplerHandle handle);
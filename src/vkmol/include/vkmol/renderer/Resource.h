@@ -24,11 +24,14 @@
 #define VKMOL_RENDERER_RESOURCE_H
 
 #include "Buffer.h"
+#include "Swapchain.h"
 
+#include <atomic>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <type_traits>
-#include <unordered_map>
+#include <vector>
 
 #undef _LIBCPP_USE_AVAILABILITY_APPLE
 #include <variant>
@@ -41,56 +44,119 @@ namespace renderer {
 template <class T>
 class ResourceContainer;
 
+/*
+ * A handle is an index into a ResourceContainer's slot table plus the
+ * generation that slot had when the resource was added. Removing a resource
+ * bumps the slot's generation, so stale handles are detected rather than
+ * silently aliasing whatever resource later reuses the slot.
+ *
+ * Generation 0 is never issued, so a default constructed handle is invalid.
+ */
 template <class T>
 class ResourceHandle {
 private:
     friend class ResourceContainer<T>;
 
-    uint32_t id;
+    uint32_t index;
+    uint32_t generation;
 
-    explicit ResourceHandle(uint32_t handle) : id(handle){};
+    ResourceHandle(uint32_t index, uint32_t generation)
+    : index(index), generation(generation){};
 
 public:
-    ResourceHandle() : id(0){};
+    ResourceHandle() : index(0), generation(0){};
 
     ~ResourceHandle() = default;
 
 #pragma mark - Lifecycle
 
-    ResourceHandle(const ResourceHandle<T> &other) : id(other.id) {}
+    ResourceHandle(const ResourceHandle<T> &other)
+    : index(other.index), generation(other.generation) {}
     ResourceHandle &operator=(const ResourceHandle<T> &other) {
-        id = other.id;
+        index      = other.index;
+        generation = other.generation;
         return *this;
     }
 
-    ResourceHandle(ResourceHandle<T> &&other) : id(other.id) {}
+    ResourceHandle(ResourceHandle<T> &&other)
+    : index(other.index), generation(other.generation) {}
     ResourceHandle &operator=(ResourceHandle<T> &&other) {
-        id       = other.id;
-        other.id = 0;
+        index            = other.index;
+        generation       = other.generation;
+        other.index      = 0;
+        other.generation = 0;
         return *this;
     }
 
 #pragma mark - Boolean Utilities
 
     bool operator==(const ResourceHandle<T> &other) const {
-        return id == other.id;
+        return index == other.index && generation == other.generation;
     }
 
-    explicit operator bool() const { return id != 0; }
+    explicit operator bool() const { return generation != 0; }
 };
 
 #pragma mark - Resource Container
 
+/*
+ * A dense slot map. Resources live contiguously in `resources`, so lookups
+ * are two array indexings and iteration touches no holes. Removal moves the
+ * last resource into the vacated position and patches its slot.
+ *
+ * Only reserve() may be called concurrently (with anything). It hands out
+ * never-used slots by bumping an atomic counter, so the slot table itself
+ * may lag behind until the reserved handle is commit()ted by the owning
+ * thread.
+ */
 template <class T>
 class ResourceContainer {
 private:
-    std::unordered_map<uint32_t, T> resources;
-    unsigned int                    next;
+    static constexpr uint32_t NoSlot  = UINT32_MAX;
+    static constexpr uint32_t Pending = UINT32_MAX - 1;
+
+    struct Slot {
+        // Position in `resources` while live, next free slot otherwise.
+        uint32_t dense;
+        uint32_t generation;
+    };
+
+    std::vector<T>        resources;
+    std::vector<uint32_t> owners; // Slot index of each dense resource.
+    std::vector<Slot>     slots;
+    uint32_t              freeList;
+    std::atomic<uint32_t> nextSlot;
+
+    uint32_t lookup(ResourceHandle<T> handle) const {
+        assert(handle.generation != 0);
+        assert(handle.index < slots.size());
+
+        const Slot &slot = slots[handle.index];
+        assert(slot.generation == handle.generation && "stale handle");
+        assert(slot.dense < resources.size() && "uncommitted handle");
+
+        return slot.dense;
+    }
+
+    // Fresh slots start out pending, in case they were reserved.
+    void growSlots(uint32_t index) {
+        while (slots.size() <= index) { slots.push_back({Pending, 1}); }
+    }
+
+    T &emplace(uint32_t index) {
+        Slot &slot = slots[index];
+        slot.dense = static_cast<uint32_t>(resources.size());
+
+        resources.emplace_back();
+        owners.push_back(index);
+
+        return resources.back();
+    }
 
 public:
 #pragma mark - Lifecycle
 
-    ResourceContainer() : next(1){};
+    ResourceContainer() : freeList(NoSlot), nextSlot(0){};
 
     ResourceContainer(const ResourceContainer<T> &) = delete;
     ResourceContainer &operator=(const ResourceContainer<T> &) = delete;
@@ -103,84 +169,115 @@ public:
 #pragma mark - Operations
 
     std::pair<T &, ResourceHandle<T>> add() {
-        unsigned int handle = next++;
+        uint32_t index;
+        if (freeList != NoSlot) {
+            index    = freeList;
+            freeList = slots[index].dense;
+        } else {
+            index = nextSlot.fetch_add(1, std::memory_order_relaxed);
+            growSlots(index);
+        }
 
-        auto result = resources.emplace(handle, T());
-        assert(result.second);
+        T &resource = emplace(index);
 
-        return std::make_pair(std::ref(result.first->second),
-                              ResourceHandle<T>(handle));
+        return std::make_pair(
+            std::ref(resource),
+            ResourceHandle<T>(index, slots[index].generation));
     }
 
-    const T &get(ResourceHandle<T> handle) const {
-        assert(handle.id != 0);
-
-        auto it = resources.find(handle.id);
-        assert(it != std::end(resources));
-
-        return it->second;
+    // Lock-free. The handle is not contained until it is committed.
+    ResourceHandle<T> reserve() {
+        return ResourceHandle<T>(
+            nextSlot.fetch_add(1, std::memory_order_relaxed), 1);
     }
 
-    T &&get(ResourceHandle<T> handle) {
-        assert(handle.id != 0);
+    T &commit(ResourceHandle<T> handle) {
+        assert(handle.generation == 1);
+        growSlots(handle.index);
+        assert(slots[handle.index].dense == Pending);
 
-        auto it = resources.find(handle.id);
-        assert(it != std::end(resources));
+        return emplace(handle.index);
+    }
 
-        return it->second;
+    bool contains(ResourceHandle<T> handle) const {
+        return handle.generation != 0 && handle.index < slots.size()
+               && slots[handle.index].generation == handle.generation
+               && slots[handle.index].dense < resources.size();
     }
 
-    void remove(ResourceHandle<T> handle) {
-        assert(handle.id != 0);
+    const T &get(ResourceHandle<T> handle) const {
+        return resources[lookup(handle)];
+    }
 
-        auto it = resources.find(handle.id);
-        assert(it != std::end(resources));
+    T &get(ResourceHandle<T> handle) { return resources[lookup(handle)]; }
 
-        resources.erase(it);
+    void remove(ResourceHandle<T> handle) {
+        removeWith(handle, [](T &) {});
     }
 
     template <typename F>
     void removeWith(ResourceHandle<T> handle, F &&f) {
-        assert(handle.id != 0);
+        uint32_t dense = lookup(handle);
+
+        f(resources[dense]);
 
-        auto it = resources.find(handle.id);
-        assert(it != std::end(resources));
+        uint32_t last = static_cast<uint32_t>(resources.size()) - 1;
+        if (dense != last) {
+            resources[dense]           = std::move(resources[last]);
+            owners[dense]              = owners[last];
+            slots[owners[dense]].dense = dense;
+        }
+        resources.pop_back();
+        owners.pop_back();
 
-        f(it->second);
-        resources.erase(it);
+        Slot &slot = slots[handle.index];
+        slot.dense = freeList;
+        freeList   = handle.index;
+
+        // Skip generation 0, which marks invalid handles.
+        if (++slot.generation == 0) { slot.generation = 1; }
     }
 
     template <typename F>
     void clearWith(F &&f) {
-        auto it = std::begin(resources);
-        while (it != std::end(resources)) {
-            f(it->second);
-            it = resources.erase(it);
+        for (auto &resource : resources) { f(resource); }
+        resources.clear();
+        owners.clear();
+
+        // Retire every slot so outstanding handles become stale. Pending
+        // slots stay pending for their eventual commit.
+        freeList = NoSlot;
+        for (uint32_t i = static_cast<uint32_t>(slots.size()); i-- > 0;) {
+            Slot &slot = slots[i];
+            if (slot.dense == Pending) continue;
+            if (++slot.generation == 0) { slot.generation = 1; }
+            slot.dense = freeList;
+            freeList   = i;
         }
     }
-};
 
-#pragma mark - Variant Declaration
-
-typedef std::variant<Buffer> Resource;
+#pragma mark - Iteration
 
-#pragma mark - Resource Visitors
+    size_t size() const { return resources.size(); }
+    bool   empty() const { return resources.empty(); }
 
-struct ResourceHasher final {
-    size_t operator()(const Buffer &b) const;
+    typename std::vector<T>::iterator begin() {
+        return resources.begin();
+    }
+    typename std::vector<T>::iterator end() { return resources.end(); }
+    typename std::vector<T>::const_iterator begin() const {
+        return resources.begin();
+    }
+    typename std::vector<T>::const_iterator end() const {
+        return resources.end();
+    }
 };
 
-}; // namespace renderer
-}; // namespace vkmol
+#pragma mark - Variant Declaration
 
-namespace std {
+typedef std::variant<Buffer, RetiredSwapchain> Resource;
 
-template <>
-struct hash<vkmol::renderer::Resource> {
-    size_t operator()(const vkmol::renderer::Resource &r) const {
-        return std::visit(vkmol::renderer::ResourceHasher(), r);
-    }
-};
-} // namespace std
+}; // namespace renderer
+}; // namespace vkmol
 
 #endif // VKMOL_RENDERER_RESOURCE_H
@@ -23,18 +23,51 @@
 #ifndef VKMOL_RENDERER_SWAPCHAIN_H
 #define VKMOL_RENDERER_SWAPCHAIN_H
 
+#include <cstddef>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
 namespace vkmol {
 namespace renderer {
 
+// Fifo waits for vertical blank, capping the frame rate at the display's;
+// FifoRelaxed tears instead when a frame is late. Mailbox replaces frames
+// waiting to be shown with newer ones, which lowers latency without
+// tearing, and Immediate tears. Modes the surface does not support fall
+// back to the closest that it does, ending with Fifo, which it must.
+enum class PresentMode { Fifo, FifoRelaxed, Mailbox, Immediate };
+
 struct SwapchainInfo {
     unsigned int width      = 0;
     unsigned int height     = 0;
     unsigned int imageCount = 3;
     bool         fullscreen = false;
 
+    PresentMode presentMode = PresentMode::Fifo;
+
+    // How many frames may be submitted but not yet completed when the next
+    // begins; beginFrame() waits otherwise. One trades throughput for the
+    // lowest latency. Zero leaves it to the number of frames in flight.
+    unsigned int maxQueuedFrames = 0;
+
+    // Frames per second beginFrame() paces to, or zero for no limit.
+    unsigned int frameRateLimit = 0;
+
     SwapchainInfo() = default;
 };
 
+// A swapchain replaced by recreation, along with its image views. Frames
+// still in flight may present from it, so it goes through the deletion
+// queues like any other resource.
+struct RetiredSwapchain {
+    vk::SwapchainKHR           swapchain;
+    std::vector<vk::ImageView> imageViews;
+
+    // Not memory we allocated, so nothing to count against the budget.
+    size_t size = 0;
+};
+
 }; // namespace renderer
 }; // namespace vkmol
 
@@ -0,0 +1,89 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_THREADPOOL_H
+#define VKMOL_RENDERER_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkmol {
+namespace renderer {
+
+/*
+ * A fixed set of threads that run one job at a time, all of them together.
+ * The calling thread takes part as thread 0, so a pool of n workers runs
+ * jobs on n + 1 threads. Jobs are expected to split the work themselves,
+ * e.g. by taking chunks off an atomic counter.
+ *
+ * run() is not reentrant, and jobs must not throw.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(unsigned int thread)> Job;
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const Job *job        = nullptr;
+    uint64_t   generation = 0;
+    size_t     pending    = 0;
+    bool       stopping   = false;
+
+    void work(unsigned int thread);
+
+public:
+#pragma mark - Lifecycle
+
+    explicit ThreadPool(unsigned int workerCount);
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ThreadPool(ThreadPool &&) = delete;
+    ThreadPool &operator=(ThreadPool &&) = delete;
+
+    ~ThreadPool();
+
+#pragma mark - Operations
+
+    // Counting the calling thread.
+    unsigned int size() const {
+        return static_cast<unsigned int>(workers.size()) + 1;
+    }
+
+    // Returns once job has returned on every thread.
+    void run(const Job &job);
+};
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif // VKMOL_RENDERER_THREADPOOL_H
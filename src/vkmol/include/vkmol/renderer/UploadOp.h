@@ -36,10 +36,6 @@ struct UploadOp {
     vk::Semaphore          semaphore;
     vk::PipelineStageFlags semaphoreWaitMask;
 
-    vk::Buffer        stagingBuffer;
-    VmaAllocation     memory         = nullptr;
-    VmaAllocationInfo allocationInfo = {};
-
     std::vector<vk::ImageMemoryBarrier>  imageAcquireBarriers;
     std::vector<vk::BufferMemoryBarrier> bufferAcquireBarriers;
 
@@ -0,0 +1,78 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_VIRTUALBLOCK_H
+#define VKMOL_RENDERER_VIRTUALBLOCK_H
+
+#include <cstdint>
+#include <map>
+
+namespace vkmol {
+namespace renderer {
+
+/*
+ * Bookkeeping for sub-allocating a fixed range of offsets, such as a large
+ * vk::Buffer. It owns no memory itself; it only decides where things go.
+ *
+ * Free ranges are indexed by offset (to coalesce neighbours on free) and by
+ * size (for best-fit allocation), so both operations are logarithmic in the
+ * number of free ranges.
+ */
+class VirtualBlock {
+private:
+    uint32_t size;
+    uint32_t used;
+
+    std::map<uint32_t, uint32_t>      freeByOffset; // offset -> size
+    std::multimap<uint32_t, uint32_t> freeBySize;   // size -> offset
+
+    void insertFreeRange(uint32_t offset, uint32_t size);
+    void eraseFreeRange(std::map<uint32_t, uint32_t>::iterator it);
+
+public:
+#pragma mark - Lifecycle
+
+    explicit VirtualBlock(uint32_t size = 0);
+
+    VirtualBlock(const VirtualBlock &) = delete;
+    VirtualBlock &operator=(const VirtualBlock &) = delete;
+
+    VirtualBlock(VirtualBlock &&) = default;
+    VirtualBlock &operator=(VirtualBlock &&) = default;
+
+    ~VirtualBlock() = default;
+
+#pragma mark - Operations
+
+    // Alignment must be a power of two. Returns false if no free range fits.
+    bool allocate(uint32_t size, uint32_t alignment, uint32_t &offset);
+    void free(uint32_t offset, uint32_t size);
+
+    uint32_t getSize() const { return size; }
+    uint32_t getUsed() const { return used; }
+    bool     isEmpty() const { return used == 0; }
+};
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif // VKMOL_RENDERER_VIRTUALBLOCK_H
@@ -0,0 +1,90 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef VKMOL_RENDERER_WORKERCONTEXT_H
+#define VKMOL_RENDERER_WORKERCONTEXT_H
+
+#include "Buffer.h"
+#include "Resource.h"
+
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace vkmol {
+namespace renderer {
+
+/*
+ * Per-thread state for creating buffers off the rendering thread: staging
+ * memory to copy contents into, and the buffers waiting for the renderer to
+ * pick them up. Only the Renderer touches the members.
+ *
+ * The owning thread and the renderer's flush are the only parties, so the
+ * mutex is essentially uncontended.
+ */
+struct WorkerContext {
+    struct Pending {
+        ResourceHandle<Buffer> handle;
+
+        // Created by the worker, unless the buffer is pooled; pool blocks
+        // are sub-allocated by the renderer when it commits the handle.
+        Buffer     buffer;
+        BufferType type = BufferType::Invalid;
+        uint32_t   size = 0;
+
+        // Reserved handles are committed by the flush, other handles
+        // already exist and only need their contents copied.
+        bool reserved = false;
+
+        // Null if the contents were written directly.
+        vk::Buffer     stagingBuffer;
+        uint32_t       stagingOffset = 0;
+        const uint8_t *stagingData   = nullptr;
+    };
+
+    std::mutex mutex;
+
+    // Host visible and persistently mapped. Once full, it is set aside in
+    // retiredStaging until the flush has recorded the copies out of it.
+    Buffer              staging;
+    uint8_t *           stagingMapping = nullptr;
+    uint32_t            stagingUsed    = 0;
+    std::vector<Buffer> retiredStaging;
+
+    std::vector<Pending> pending;
+
+    WorkerContext() = default;
+
+    WorkerContext(const WorkerContext &) = delete;
+    WorkerContext &operator=(const WorkerContext &) = delete;
+
+    WorkerContext(WorkerContext &&) = delete;
+    WorkerContext &operator=(WorkerContext &&) = delete;
+
+    ~WorkerContext() = default;
+};
+
+}; // namespace renderer
+}; // namespace vkmol
+
+#endif // VKMOL_RENDERER_WORKERCONTEXT_H
@@ -53,6 +53,8 @@ Buffer::Buffer(Buffer &&other) noexcept
 Buffer &Buffer::operator=(Buffer &&other) noexcept {
     if (this == &other) { return *this; }
 
+    // Should not be move assigning over valid buffers.
+    assert(type == BufferType::Invalid);
     assert(!buffer);
     assert(!memory);
 
@@ -72,9 +74,6 @@ Buffer &Buffer::operator=(Buffer &&other) noexcept {
     other.memory         = nullptr;
     other.lastUsedFrame  = 0;
 
-    // Should not be move assigning valid buffers.
-    assert(type == BufferType::Invalid);
-
     return *this;
 }
 
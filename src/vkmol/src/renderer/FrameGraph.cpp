@@ -0,0 +1,719 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "vkmol/renderer/FrameGraph.h"
+#include "vkmol/private/Utilities.h"
+#include "vkmol/private/loguru/loguru.hpp"
+#include "vkmol/renderer/Renderer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace vkmol {
+namespace renderer {
+
+#pragma mark - Utilities
+
+namespace {
+
+struct AccessInfo {
+    vk::ImageLayout        layout;
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags        access;
+    vk::ImageUsageFlags    usage;
+};
+
+AccessInfo accessInfo(ImageAccess access, bool write) {
+    using Stage  = vk::PipelineStageFlagBits;
+    using Access = vk::AccessFlagBits;
+    using Usage  = vk::ImageUsageFlagBits;
+
+    switch (access) {
+    case ImageAccess::ColorAttachment:
+        return {vk::ImageLayout::eColorAttachmentOptimal,
+                Stage::eColorAttachmentOutput,
+                write ? Access::eColorAttachmentRead
+                            | Access::eColorAttachmentWrite
+                      : vk::AccessFlags(Access::eColorAttachmentRead),
+                Usage::eColorAttachment};
+    case ImageAccess::DepthAttachment:
+        return {vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+                write ? Access::eDepthStencilAttachmentRead
+                            | Access::eDepthStencilAttachmentWrite
+                      : vk::AccessFlags(Access::eDepthStencilAttachmentRead),
+                Usage::eDepthStencilAttachment};
+    case ImageAccess::DepthRead:
+        assert(!write);
+        return {vk::ImageLayout::eDepthStencilReadOnlyOptimal,
+                Stage::eEarlyFragmentTests | Stage::eLateFragmentTests
+                    | Stage::eFragmentShader,
+                Access::eDepthStencilAttachmentRead | Access::eShaderRead,
+                Usage::eDepthStencilAttachment | Usage::eSampled};
+    case ImageAccess::Sampled:
+        assert(!write);
+        return {vk::ImageLayout::eShaderReadOnlyOptimal,
+                Stage::eFragmentShader | Stage::eComputeShader,
+                Access::eShaderRead, Usage::eSampled};
+    case ImageAccess::Storage:
+        return {vk::ImageLayout::eGeneral,
+                Stage::eFragmentShader | Stage::eComputeShader,
+                write ? Access::eShaderRead | Access::eShaderWrite
+                      : vk::AccessFlags(Access::eShaderRead),
+                Usage::eStorage};
+    case ImageAccess::TransferSource:
+        assert(!write);
+        return {vk::ImageLayout::eTransferSrcOptimal, Stage::eTransfer,
+                Access::eTransferRead, Usage::eTransferSrc};
+    case ImageAccess::TransferDestination:
+        assert(write);
+        return {vk::ImageLayout::eTransferDstOptimal, Stage::eTransfer,
+                Access::eTransferWrite, Usage::eTransferDst};
+    }
+
+    UNREACHABLE();
+}
+
+vk::ImageAspectFlags formatAspect(vk::Format format) {
+    switch (format) {
+    case vk::Format::eD16Unorm:
+    case vk::Format::eX8D24UnormPack32:
+    case vk::Format::eD32Sfloat: return vk::ImageAspectFlagBits::eDepth;
+    case vk::Format::eD16UnormS8Uint:
+    case vk::Format::eD24UnormS8Uint:
+    case vk::Format::eD32SfloatS8Uint:
+        return vk::ImageAspectFlagBits::eDepth
+               | vk::ImageAspectFlagBits::eStencil;
+    case vk::Format::eS8Uint: return vk::ImageAspectFlagBits::eStencil;
+    default: return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+bool operator==(const TransientImageDesc &a, const TransientImageDesc &b) {
+    return a.width == b.width && a.height == b.height
+           && a.format == b.format && a.samples == b.samples;
+}
+
+bool overlaps(uint32_t firstA, uint32_t lastA, uint32_t firstB,
+              uint32_t lastB) {
+    return !(lastA < firstB || lastB < firstA);
+}
+
+} // namespace
+
+#pragma mark - Builder
+
+FrameGraphImage FrameGraph::Builder::create(const std::string &       name,
+                                            const TransientImageDesc &desc) {
+    assert(desc.width > 0 && desc.height > 0);
+    assert(desc.format != vk::Format::eUndefined);
+
+    Image image;
+    image.name = name;
+    image.desc = desc;
+    graph.images.emplace_back(std::move(image));
+
+    FrameGraphImage handle;
+    handle.index = static_cast<uint32_t>(graph.images.size() - 1);
+    return handle;
+}
+
+void FrameGraph::Builder::read(FrameGraphImage image, ImageAccess access) {
+    assert(image.index < graph.images.size());
+
+    Pass &p = graph.passes[pass];
+    assert(std::none_of(p.uses.begin(), p.uses.end(), [&](const Use &use) {
+        return use.image == image.index;
+    }));
+
+    Use use;
+    use.image  = image.index;
+    use.access = access;
+    use.write  = false;
+    p.uses.push_back(use);
+
+    graph.images[image.index].usage |= accessInfo(access, false).usage;
+}
+
+void FrameGraph::Builder::write(FrameGraphImage image, ImageAccess access) {
+    assert(image.index < graph.images.size());
+
+    Pass &p = graph.passes[pass];
+    assert(std::none_of(p.uses.begin(), p.uses.end(), [&](const Use &use) {
+        return use.image == image.index;
+    }));
+
+    Use use;
+    use.image  = image.index;
+    use.access = access;
+    use.write  = true;
+    p.uses.push_back(use);
+
+    graph.images[image.index].usage |= accessInfo(access, true).usage;
+}
+
+#pragma mark - Lifecycle
+
+FrameGraph::FrameGraph(Renderer &renderer) : renderer(renderer) {}
+
+FrameGraph::~FrameGraph() {
+    if (lastExecutedFrame > renderer.lastSyncedFrame) {
+        // Only a submitted frame can be waited for.
+        assert(lastExecutedFrame < renderer.currentFrame);
+        renderer.waitForFrame(lastExecutedFrame);
+        renderer.markFrameSynced(lastExecutedFrame);
+    }
+
+    destroyPhysical(physicalImages, physicalMemory);
+    collectRetired(true);
+}
+
+void FrameGraph::destroyPhysical(std::vector<PhysicalImage> &images,
+                                 std::vector<VmaAllocation> &memory) {
+    for (auto &image : images) {
+        renderer.device.destroyImageView(image.view,
+                                         renderer.allocationCallbacks);
+        renderer.device.destroyImage(image.image,
+                                     renderer.allocationCallbacks);
+    }
+    images.clear();
+
+    for (auto allocation : memory) {
+        vmaFreeMemory(renderer.allocator, allocation);
+    }
+    memory.clear();
+}
+
+void FrameGraph::retirePhysical() {
+    if (physicalImages.empty()) return;
+
+    if (lastExecutedFrame <= renderer.lastSyncedFrame) {
+        destroyPhysical(physicalImages, physicalMemory);
+        return;
+    }
+
+    Retired r;
+    r.frame  = lastExecutedFrame;
+    r.images = std::move(physicalImages);
+    r.memory = std::move(physicalMemory);
+    retired.emplace_back(std::move(r));
+
+    physicalImages.clear();
+    physicalMemory.clear();
+}
+
+void FrameGraph::collectRetired(bool all) {
+    auto it = retired.begin();
+    for (; it != retired.end(); ++it) {
+        if (!all && it->frame > renderer.lastSyncedFrame) break;
+        destroyPhysical(it->images, it->memory);
+    }
+    retired.erase(retired.begin(), it);
+}
+
+#pragma mark - Building
+
+void FrameGraph::reset() {
+    passes.clear();
+    images.clear();
+    compiled = false;
+}
+
+FrameGraphImage FrameGraph::importImage(const std::string &name,
+                                        vk::Image          image,
+                                        vk::ImageView      view,
+                                        vk::Format         format,
+                                        vk::Extent2D       extent,
+                                        vk::ImageLayout    initialLayout,
+                                        vk::ImageLayout    finalLayout) {
+    assert(image);
+
+    Image imported;
+    imported.name          = name;
+    imported.desc.width    = extent.width;
+    imported.desc.height   = extent.height;
+    imported.desc.format   = format;
+    imported.imported      = true;
+    imported.image         = image;
+    imported.view          = view;
+    imported.initialLayout = initialLayout;
+    imported.finalLayout   = finalLayout;
+    images.emplace_back(std::move(imported));
+
+    FrameGraphImage handle;
+    handle.index = static_cast<uint32_t>(images.size() - 1);
+    return handle;
+}
+
+void FrameGraph::markOutput(FrameGraphImage image) {
+    assert(image.index < images.size());
+    images[image.index].output = true;
+}
+
+void FrameGraph::addPass(const std::string &    name,
+                         const SetupCallback &  setup,
+                         const ExecuteCallback &execute) {
+    assert(!compiled);
+
+    Pass pass;
+    pass.name    = name;
+    pass.execute = execute;
+    passes.emplace_back(std::move(pass));
+
+    Builder builder(*this, static_cast<uint32_t>(passes.size() - 1));
+    setup(builder);
+}
+
+#pragma mark - Compilation
+
+void FrameGraph::compile() {
+    assert(!compiled);
+
+    collectRetired(false);
+
+    cull();
+    allocateTransients();
+    computeBarriers();
+
+    compiled = true;
+}
+
+void FrameGraph::cull() {
+    for (auto &image : images) { image.live = image.output; }
+
+    // Passes were added in an order that works, so walking them backwards
+    // sees every reader of an image before its writers.
+    for (auto pass = passes.rbegin(); pass != passes.rend(); ++pass) {
+        pass->live = pass->sideEffects;
+
+        for (auto &use : pass->uses) {
+            const Image &image = images[use.image];
+            if (use.write && (image.live || image.imported)) {
+                pass->live = true;
+            }
+        }
+
+        if (!pass->live) continue;
+
+        for (auto &use : pass->uses) { images[use.image].live = true; }
+    }
+
+    statistics.passes       = static_cast<uint32_t>(passes.size());
+    statistics.culledPasses = 0;
+
+    for (uint32_t i = 0; i < passes.size(); ++i) {
+        if (!passes[i].live) {
+            VLOG_F(1, "Culled pass %s", passes[i].name.c_str());
+            statistics.culledPasses++;
+            continue;
+        }
+
+        for (auto &use : passes[i].uses) {
+            Image &image    = images[use.image];
+            image.firstPass = std::min(image.firstPass, i);
+            image.lastPass  = std::max(image.lastPass, i);
+        }
+    }
+}
+
+void FrameGraph::allocateTransients() {
+    std::vector<uint32_t> transients;
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        if (!images[i].imported && images[i].live) transients.push_back(i);
+    }
+
+    // The same transients, used by the same passes, as last time.
+    bool reuse = transients.size() == physicalImages.size();
+    for (size_t k = 0; reuse && k < transients.size(); ++k) {
+        const Image &        image    = images[transients[k]];
+        const PhysicalImage &physical = physicalImages[k];
+
+        reuse = image.desc == physical.desc && image.usage == physical.usage
+                && image.firstPass == physical.firstPass
+                && image.lastPass == physical.lastPass;
+    }
+
+    if (!reuse) {
+        retirePhysical();
+
+        LOG_SCOPE_F(INFO, "Creating %zu transient images", transients.size());
+
+        physicalImages.resize(transients.size());
+        for (size_t k = 0; k < transients.size(); ++k) {
+            const Image &  image    = images[transients[k]];
+            PhysicalImage &physical = physicalImages[k];
+
+            physical.desc      = image.desc;
+            physical.usage     = image.usage;
+            physical.firstPass = image.firstPass;
+            physical.lastPass  = image.lastPass;
+
+            vk::ImageCreateInfo info;
+            info.imageType     = vk::ImageType::e2D;
+            info.format        = image.desc.format;
+            info.extent        = vk::Extent3D(image.desc.width,
+                                       image.desc.height, 1);
+            info.mipLevels     = 1;
+            info.arrayLayers   = 1;
+            info.samples       = image.desc.samples;
+            info.tiling        = vk::ImageTiling::eOptimal;
+            info.usage         = image.usage;
+            info.sharingMode   = vk::SharingMode::eExclusive;
+            info.initialLayout = vk::ImageLayout::eUndefined;
+
+            physical.image = renderer.device.createImage(
+                info, renderer.allocationCallbacks);
+            physical.requirements =
+                renderer.device.getImageMemoryRequirements(physical.image);
+        }
+
+        // Largest first, each image goes into the first memory whose images
+        // are all dead before it is first used or born after it is last
+        // used, and which has a memory type for it.
+        std::vector<uint32_t> order(physicalImages.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&](uint32_t a, uint32_t b) {
+                             return physicalImages[a].requirements.size
+                                    > physicalImages[b].requirements.size;
+                         });
+
+        struct Memory {
+            vk::MemoryRequirements requirements;
+            std::vector<uint32_t>  images;
+        };
+
+        std::vector<Memory> memories;
+
+        for (uint32_t k : order) {
+            PhysicalImage &physical = physicalImages[k];
+
+            auto memory = std::find_if(
+                memories.begin(), memories.end(), [&](const Memory &m) {
+                    if (!(m.requirements.memoryTypeBits
+                          & physical.requirements.memoryTypeBits)) {
+                        return false;
+                    }
+                    return std::none_of(
+                        m.images.begin(), m.images.end(), [&](uint32_t j) {
+                            return overlaps(physical.firstPass,
+                                            physical.lastPass,
+                                            physicalImages[j].firstPass,
+                                            physicalImages[j].lastPass);
+                        });
+                });
+
+            if (memory == memories.end()) {
+                memories.emplace_back();
+                memory               = std::prev(memories.end());
+                memory->requirements = physical.requirements;
+            }
+
+            vk::MemoryRequirements &requirements = memory->requirements;
+            requirements.size =
+                std::max(requirements.size, physical.requirements.size);
+            requirements.alignment = std::max(
+                requirements.alignment, physical.requirements.alignment);
+            requirements.memoryTypeBits &=
+                physical.requirements.memoryTypeBits;
+
+            memory->images.push_back(k);
+        }
+
+        statistics.transientBytes = 0;
+        statistics.allocatedBytes = 0;
+
+        for (uint32_t m = 0; m < memories.size(); ++m) {
+            Memory &memory = memories[m];
+
+            VkMemoryRequirements    requirements = memory.requirements;
+            VmaAllocationCreateInfo requestInfo  = {};
+            requestInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+            VmaAllocation allocation = nullptr;
+            VkResult      result =
+                vmaAllocateMemory(renderer.allocator, &requirements,
+                                  &requestInfo, &allocation, nullptr);
+
+            if (result != VK_SUCCESS) {
+                LOG_F(ERROR, "vmaAllocateMemory failed: %s",
+                      vk::to_string(vk::Result(result)).c_str());
+                throw std::runtime_error("vmaAllocateMemory failed");
+            }
+
+            physicalMemory.push_back(allocation);
+            statistics.allocatedBytes += requirements.size;
+
+            // In order of use, so that each knows the image it follows.
+            std::sort(memory.images.begin(), memory.images.end(),
+                      [&](uint32_t a, uint32_t b) {
+                          return physicalImages[a].firstPass
+                                 < physicalImages[b].firstPass;
+                      });
+
+            uint32_t previous = UINT32_MAX;
+            for (uint32_t k : memory.images) {
+                PhysicalImage &physical = physicalImages[k];
+                physical.memory         = m;
+                physical.aliased        = previous;
+                previous                = k;
+
+                statistics.transientBytes += physical.requirements.size;
+
+                result = vmaBindImageMemory(renderer.allocator, allocation,
+                                            physical.image);
+                if (result != VK_SUCCESS) {
+                    LOG_F(ERROR, "vmaBindImageMemory failed: %s",
+                          vk::to_string(vk::Result(result)).c_str());
+                    throw std::runtime_error("vmaBindImageMemory failed");
+                }
+
+                vk::ImageViewCreateInfo viewInfo;
+                viewInfo.image    = physical.image;
+                viewInfo.viewType = vk::ImageViewType::e2D;
+                viewInfo.format   = physical.desc.format;
+                viewInfo.subresourceRange.aspectMask =
+                    formatAspect(physical.desc.format);
+                viewInfo.subresourceRange.levelCount = 1;
+                viewInfo.subresourceRange.layerCount = 1;
+
+                physical.view = renderer.device.createImageView(
+                    viewInfo, renderer.allocationCallbacks);
+            }
+        }
+
+        LOG_F(INFO, "%zu transient bytes in %zu allocated bytes",
+              statistics.transientBytes, statistics.allocatedBytes);
+
+        // Fresh memory, which no frame has used yet.
+        executedStates.assign(memories.size(), MemoryState());
+    }
+
+    for (uint32_t k = 0; k < transients.size(); ++k) {
+        Image &image   = images[transients[k]];
+        image.physical = k;
+        image.image    = physicalImages[k].image;
+        image.view     = physicalImages[k].view;
+    }
+}
+
+void FrameGraph::computeBarriers() {
+    struct State {
+        vk::ImageLayout        layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags        access;
+        bool                   written = false;
+        bool                   started = false;
+    };
+
+    std::vector<State> states(images.size());
+
+    // The image each physical image is currently standing in for.
+    std::vector<uint32_t> owners(physicalImages.size(), UINT32_MAX);
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        if (images[i].physical != UINT32_MAX) {
+            owners[images[i].physical] = i;
+        }
+    }
+
+    statistics.barriers = 0;
+
+    for (auto &pass : passes) {
+        pass.barriers.clear();
+        pass.sourceStages      = vk::PipelineStageFlags();
+        pass.destinationStages = vk::PipelineStageFlags();
+
+        if (!pass.live) continue;
+
+        for (auto &use : pass.uses) {
+            const Image &image = images[use.image];
+            State &      state = states[use.image];
+            AccessInfo   info  = accessInfo(use.access, use.write);
+
+            if (!state.started) {
+                state.started = true;
+
+                if (image.imported) {
+                    // Whatever the owner did before is not known.
+                    state.layout = image.initialLayout;
+                    state.stages = vk::PipelineStageFlagBits::eAllCommands;
+                } else {
+                    // The memory is taken over from the image it follows,
+                    // whose work has to finish first.
+                    const PhysicalImage &physical =
+                        physicalImages[image.physical];
+                    if (physical.aliased != UINT32_MAX) {
+                        state         = states[owners[physical.aliased]];
+                        state.layout  = vk::ImageLayout::eUndefined;
+                        state.started = true;
+                    } else {
+                        // Or, for the first image in the memory, from the
+                        // last image in it in the previous frame.
+                        const MemoryState &previous =
+                            executedStates[physical.memory];
+                        state.stages  = previous.stages;
+                        state.access  = previous.writes;
+                        state.written = static_cast<bool>(previous.writes);
+                    }
+                }
+            }
+
+            bool transition = state.layout != info.layout;
+            bool hazard     = state.written || use.write;
+
+            if (!transition && !(hazard && state.stages)) {
+                // Reads after reads (or a first use) need no barrier.
+                state.stages |= info.stages;
+                state.access |= info.access;
+                state.written = state.written || use.write;
+                continue;
+            }
+
+            vk::ImageMemoryBarrier barrier;
+            barrier.srcAccessMask = state.written ? state.access
+                                                  : vk::AccessFlags();
+            barrier.dstAccessMask = info.access;
+            barrier.oldLayout     = state.layout;
+            barrier.newLayout     = info.layout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image               = image.image;
+            barrier.subresourceRange.aspectMask =
+                formatAspect(image.desc.format);
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.layerCount = 1;
+            pass.barriers.push_back(barrier);
+
+            pass.sourceStages |=
+                state.stages ? state.stages
+                             : vk::PipelineStageFlagBits::eTopOfPipe;
+            pass.destinationStages |= info.stages;
+
+            state.layout  = info.layout;
+            state.stages  = info.stages;
+            state.access  = info.access;
+            state.written = use.write;
+        }
+
+        statistics.barriers += static_cast<uint32_t>(pass.barriers.size());
+    }
+
+    // The last image in each memory is the one used last.
+    compiledStates.assign(executedStates.size(), MemoryState());
+    std::vector<uint32_t> lastPasses(executedStates.size(), 0);
+
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        const Image &image = images[i];
+        const State &state = states[i];
+        if (image.imported || !state.started) continue;
+
+        uint32_t memory = physicalImages[image.physical].memory;
+        if (compiledStates[memory].stages
+            && lastPasses[memory] > image.lastPass) {
+            continue;
+        }
+
+        lastPasses[memory]            = image.lastPass;
+        compiledStates[memory].stages = state.stages;
+        compiledStates[memory].writes =
+            state.written ? state.access : vk::AccessFlags();
+    }
+
+    // Imported images are handed back in the layout their owner wants.
+    finalBarriers.clear();
+    finalSourceStages = vk::PipelineStageFlags();
+
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        const Image &image = images[i];
+        const State &state = states[i];
+
+        if (!image.imported || !state.started) continue;
+        if (image.finalLayout == vk::ImageLayout::eUndefined) continue;
+        if (image.finalLayout == state.layout) continue;
+
+        vk::ImageMemoryBarrier barrier;
+        barrier.srcAccessMask =
+            state.written ? state.access : vk::AccessFlags();
+        barrier.oldLayout           = state.layout;
+        barrier.newLayout           = image.finalLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = image.image;
+        barrier.subresourceRange.aspectMask =
+            formatAspect(image.desc.format);
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+        finalBarriers.push_back(barrier);
+
+        finalSourceStages |= state.stages;
+    }
+
+    statistics.barriers += static_cast<uint32_t>(finalBarriers.size());
+}
+
+#pragma mark - Execution
+
+void FrameGraph::execute(vk::CommandBuffer commandBuffer) {
+    assert(compiled);
+
+    for (auto &pass : passes) {
+        if (!pass.live) continue;
+
+        if (!pass.barriers.empty()) {
+            commandBuffer.pipelineBarrier(
+                pass.sourceStages, pass.destinationStages,
+                vk::DependencyFlags(), nullptr, nullptr, pass.barriers);
+        }
+
+        if (pass.execute) { pass.execute(commandBuffer, *this); }
+    }
+
+    if (!finalBarriers.empty()) {
+        commandBuffer.pipelineBarrier(
+            finalSourceStages, vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(), nullptr, nullptr, finalBarriers);
+    }
+
+    lastExecutedFrame = renderer.currentFrame;
+    executedStates    = compiledStates;
+}
+
+vk::Image FrameGraph::getImage(FrameGraphImage image) const {
+    assert(compiled);
+    assert(image.index < images.size());
+    return images[image.index].image;
+}
+
+vk::ImageView FrameGraph::getImageView(FrameGraphImage image) const {
+    assert(compiled);
+    assert(image.index < images.size());
+    return images[image.index].view;
+}
+
+TransientImageDesc FrameGraph::getImageDesc(FrameGraphImage image) const {
+    assert(image.index < images.size());
+    return images[image.index].desc;
+}
+
+}; // namespace renderer
+}; // namespace vkmol
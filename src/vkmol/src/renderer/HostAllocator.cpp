@@ -0,0 +1,243 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "vkmol/renderer/HostAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace vkmol {
+namespace renderer {
+
+#pragma mark - Utilities
+
+namespace {
+
+struct Arena;
+
+// Precedes every pointer handed to the driver.
+struct Header {
+    size_t                  size;
+    Arena *                 arena;  // Null for heap allocations.
+    void *                  raw;    // What to free, for heap allocations.
+    VkSystemAllocationScope scope;
+};
+
+const size_t arenaSize = 65536; // 64KiB
+
+struct Arena {
+    std::unique_ptr<uint8_t[]> memory{new uint8_t[arenaSize]};
+    size_t                     used = 0;
+
+    // Frees may come from another thread in principle, so this is atomic;
+    // only the owning thread ever rewinds the arena.
+    std::atomic<size_t> live{0};
+};
+
+thread_local Arena commandArena;
+
+uintptr_t alignUp(uintptr_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(uintptr_t(alignment) - 1);
+}
+
+Header *headerOf(void *memory) {
+    return reinterpret_cast<Header *>(memory) - 1;
+}
+
+void *place(void *raw, size_t rawSize, size_t size, size_t alignment) {
+    auto begin = reinterpret_cast<uintptr_t>(raw) + sizeof(Header);
+    auto memory = alignUp(begin, std::max(alignment, alignof(Header)));
+    assert(memory + size <= reinterpret_cast<uintptr_t>(raw) + rawSize);
+
+    return reinterpret_cast<void *>(memory);
+}
+
+} // namespace
+
+#pragma mark - Lifecycle
+
+HostAllocator::HostAllocator() {
+    callbacks.pUserData             = this;
+    callbacks.pfnAllocation         = allocationFunction;
+    callbacks.pfnReallocation       = reallocationFunction;
+    callbacks.pfnFree               = freeFunction;
+    callbacks.pfnInternalAllocation = internalAllocationNotification;
+    callbacks.pfnInternalFree       = internalFreeNotification;
+}
+
+#pragma mark - Operations
+
+HostAllocationStatistics HostAllocator::getStatistics() const {
+    HostAllocationStatistics statistics;
+
+    for (size_t i = 0; i < counters.size(); ++i) {
+        auto &scope            = statistics.scopes[i];
+        scope.allocations      = counters[i].allocations;
+        scope.reallocations    = counters[i].reallocations;
+        scope.frees            = counters[i].frees;
+        scope.liveBytes        = counters[i].liveBytes;
+        scope.peakLiveBytes    = counters[i].peakLiveBytes;
+        scope.totalBytes       = counters[i].totalBytes;
+        scope.arenaAllocations = counters[i].arenaAllocations;
+    }
+
+    statistics.internalLiveBytes = internalLiveBytes;
+
+    return statistics;
+}
+
+void HostAllocator::countAllocation(VkSystemAllocationScope scope,
+                                    size_t                  size) {
+    auto &c = counters[scope];
+
+    c.totalBytes += size;
+    uint64_t live = c.liveBytes += size;
+
+    uint64_t peak = c.peakLiveBytes;
+    while (live > peak && !c.peakLiveBytes.compare_exchange_weak(peak, live)) {
+    }
+}
+
+void HostAllocator::countFree(VkSystemAllocationScope scope, size_t size) {
+    counters[scope].liveBytes -= size;
+}
+
+void *HostAllocator::allocate(size_t                  size,
+                              size_t                  alignment,
+                              VkSystemAllocationScope scope) {
+    if (size == 0) return nullptr;
+
+    size_t rawSize =
+        size + sizeof(Header) + std::max(alignment, alignof(Header));
+    void * memory = nullptr;
+    Arena *arena  = nullptr;
+    void * raw    = nullptr;
+
+    if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+        Arena &a = commandArena;
+        if (a.live == 0) { a.used = 0; }
+
+        if (a.used + rawSize <= arenaSize) {
+            raw    = a.memory.get() + a.used;
+            memory = place(raw, rawSize, size, alignment);
+            a.used =
+                reinterpret_cast<uint8_t *>(memory) + size - a.memory.get();
+            a.live++;
+            arena = &a;
+
+            counters[scope].arenaAllocations++;
+        }
+    }
+
+    if (!memory) {
+        raw = std::malloc(rawSize);
+        if (!raw) return nullptr;
+        memory = place(raw, rawSize, size, alignment);
+    }
+
+    Header *header = headerOf(memory);
+    header->size   = size;
+    header->arena  = arena;
+    header->raw    = raw;
+    header->scope  = scope;
+
+    counters[scope].allocations++;
+    countAllocation(scope, size);
+
+    return memory;
+}
+
+void *HostAllocator::reallocate(void *                  original,
+                                size_t                  size,
+                                size_t                  alignment,
+                                VkSystemAllocationScope scope) {
+    if (!original) return allocate(size, alignment, scope);
+
+    if (size == 0) {
+        free(original);
+        return nullptr;
+    }
+
+    void *memory = allocate(size, alignment, scope);
+    if (!memory) return nullptr;
+
+    counters[scope].allocations--;
+    counters[scope].reallocations++;
+
+    std::memcpy(memory, original, std::min(size, headerOf(original)->size));
+    free(original);
+
+    return memory;
+}
+
+void HostAllocator::free(void *memory) {
+    if (!memory) return;
+
+    Header *header = headerOf(memory);
+
+    counters[header->scope].frees++;
+    countFree(header->scope, header->size);
+
+    if (header->arena) {
+        header->arena->live--;
+    } else {
+        std::free(header->raw);
+    }
+}
+
+#pragma mark - Callbacks
+
+void *VKAPI_PTR HostAllocator::allocationFunction(
+    void *userData, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) {
+    return static_cast<HostAllocator *>(userData)->allocate(size, alignment,
+                                                            scope);
+}
+
+void *VKAPI_PTR HostAllocator::reallocationFunction(
+    void *userData, void *original, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) {
+    return static_cast<HostAllocator *>(userData)->reallocate(
+        original, size, alignment, scope);
+}
+
+void VKAPI_PTR HostAllocator::freeFunction(void *userData, void *memory) {
+    static_cast<HostAllocator *>(userData)->free(memory);
+}
+
+void VKAPI_PTR HostAllocator::internalAllocationNotification(
+    void *userData, size_t size, VkInternalAllocationType type,
+    VkSystemAllocationScope scope) {
+    static_cast<HostAllocator *>(userData)->internalLiveBytes += size;
+}
+
+void VKAPI_PTR HostAllocator::internalFreeNotification(
+    void *userData, size_t size, VkInternalAllocationType type,
+    VkSystemAllocationScope scope) {
+    static_cast<HostAllocator *>(userData)->internalLiveBytes -= size;
+}
+
+}; // namespace renderer
+}; // namespace vkmol
@@ -0,0 +1,196 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "vkmol/renderer/Quantization.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace vkmol {
+namespace renderer {
+
+#pragma mark - Utilities
+
+namespace {
+
+void encodeOctahedral(const float *n, int16_t *out) {
+    float x = n[0], y = n[1], z = n[2];
+
+    float l1 = std::fabs(x) + std::fabs(y) + std::fabs(z);
+    if (l1 == 0.0f) {
+        out[0] = out[1] = 0;
+        return;
+    }
+
+    x /= l1;
+    y /= l1;
+
+    // Fold the lower hemisphere over the diagonals.
+    if (z < 0.0f) {
+        float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x        = fx;
+        y        = fy;
+    }
+
+    out[0] = static_cast<int16_t>(std::lround(x * 32767.0f));
+    out[1] = static_cast<int16_t>(std::lround(y * 32767.0f));
+}
+
+#if defined(__SSE2__)
+
+// Four vertices at a time: the 12 floats are transposed into x, y and z
+// lanes, which are then scaled, clamped and rounded together. origin and
+// scale hold each axis' value broadcast.
+void quantizePositions4(const float *    positions,
+                        const __m128 *   origin,
+                        const __m128 *   scale,
+                        QuantizedVertex *out) {
+    __m128 a = _mm_loadu_ps(positions);     // x0 y0 z0 x1
+    __m128 b = _mm_loadu_ps(positions + 4); // y1 z1 x2 y2
+    __m128 c = _mm_loadu_ps(positions + 8); // z2 x3 y3 z3
+
+    __m128 lanes[3];
+    lanes[0] = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)),
+                              _MM_SHUFFLE(2, 0, 3, 0));
+    lanes[1] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                              _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+                              _MM_SHUFFLE(2, 0, 2, 0));
+    lanes[2] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                              _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)),
+                              _MM_SHUFFLE(2, 0, 2, 0));
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max  = _mm_set1_ps(65535.0f);
+
+    alignas(16) int32_t values[3][4];
+
+    for (int axis = 0; axis < 3; ++axis) {
+        __m128 v = _mm_sub_ps(lanes[axis], origin[axis]);
+        v        = _mm_mul_ps(v, scale[axis]);
+        v        = _mm_min_ps(_mm_max_ps(v, zero), max);
+
+        // Rounds to nearest under the default MXCSR mode.
+        _mm_store_si128(reinterpret_cast<__m128i *>(values[axis]),
+                        _mm_cvtps_epi32(v));
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        out[i].position[0] = static_cast<uint16_t>(values[0][i]);
+        out[i].position[1] = static_cast<uint16_t>(values[1][i]);
+        out[i].position[2] = static_cast<uint16_t>(values[2][i]);
+        out[i].position[3] = 0;
+    }
+}
+
+#endif
+
+void quantizePosition(const float *             p,
+                      const QuantizationBounds &bounds,
+                      const float *             scale,
+                      QuantizedVertex &         out) {
+    for (int axis = 0; axis < 3; ++axis) {
+        float v = (p[axis] - bounds.origin[axis]) * scale[axis];
+        v       = std::min(std::max(v, 0.0f), 65535.0f);
+        out.position[axis] = static_cast<uint16_t>(std::lround(v));
+    }
+    out.position[3] = 0;
+}
+
+} // namespace
+
+#pragma mark - Operations
+
+QuantizationBounds computeQuantizationBounds(const float *positions,
+                                             size_t       count) {
+    QuantizationBounds bounds;
+    if (count == 0) return bounds;
+
+    float low[3]  = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float high[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+    for (size_t i = 0; i < count; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            low[axis]  = std::min(low[axis], positions[i * 3 + axis]);
+            high[axis] = std::max(high[axis], positions[i * 3 + axis]);
+        }
+    }
+
+    // Far enough from zero that 65535 / extent stays finite.
+    for (int axis = 0; axis < 3; ++axis) {
+        float epsilon = 1e-6f * std::max(1.0f, std::fabs(low[axis]));
+        bounds.origin[axis] = low[axis];
+        bounds.extent[axis] = std::max(high[axis] - low[axis], epsilon);
+    }
+
+    return bounds;
+}
+
+void quantizeVertices(const float *             positions,
+                      const float *             normals,
+                      size_t                    count,
+                      const QuantizationBounds &bounds,
+                      QuantizedVertex *         out) {
+    assert(positions != nullptr);
+    assert(out != nullptr);
+
+    float scale[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        assert(bounds.extent[axis] > 0.0f);
+        scale[axis] = 65535.0f / bounds.extent[axis];
+    }
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128 origin[3], scales[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        origin[axis] = _mm_set1_ps(bounds.origin[axis]);
+        scales[axis] = _mm_set1_ps(scale[axis]);
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        quantizePositions4(positions + i * 3, origin, scales, out + i);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        quantizePosition(positions + i * 3, bounds, scale, out[i]);
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (normals) {
+            encodeOctahedral(normals + i * 3, out[i].normal);
+        } else {
+            out[i].normal[0] = out[i].normal[1] = 0;
+        }
+    }
+}
+
+}; // namespace renderer
+}; // namespace vkmol
@@ -25,7 +25,22 @@
 #include "vkmol/private/loguru/loguru.hpp"
 #include "vkmol/private/vma/vk_mem_alloc.h"
 #include "vkmol/renderer/Renderer.h"
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace vkmol {
 namespace renderer {
@@ -58,9 +73,48 @@ vk::BufferUsageFlags bufferTypeUsageFlags(BufferType type) {
     case BufferType::Any: UNREACHABLE();
     }
 
+    // Contents arrive by copy from staging memory.
+    flags |= vk::BufferUsageFlagBits::eTransferDst;
+
     return flags;
 }
 
+vk::AccessFlags bufferTypeAccessFlags(BufferType type) {
+    // Besides its use, any buffer may be updated or moved by a copy.
+    vk::AccessFlags flags = vk::AccessFlagBits::eTransferRead
+                            | vk::AccessFlagBits::eTransferWrite;
+    switch (type) {
+    case BufferType::Invalid: UNREACHABLE();
+    case BufferType::Vertex:
+        return flags | vk::AccessFlagBits::eVertexAttributeRead;
+    case BufferType::Index: return flags | vk::AccessFlagBits::eIndexRead;
+    case BufferType::Uniform: return flags | vk::AccessFlagBits::eUniformRead;
+    case BufferType::Any: return flags | vk::AccessFlagBits::eShaderRead;
+    }
+}
+
+// recordParallel() makes up to this many chunks per thread, for balance,
+// but none smaller than the minimum, as each costs a command buffer.
+const uint32_t chunksPerRecordingThread = 4;
+const uint32_t minimumChunkSize         = 64;
+
+// Frame times kept for FrameStatistics.
+const size_t frameTimeWindow = 256;
+
+// Dynamic resolution goes this fraction of the way to the scale the last
+// GPU frame time asks for each frame, and renders at multiples of this many
+// pixels.
+const float    resolutionScaleDamping = 0.25f;
+const uint32_t renderExtentAlignment  = 8;
+
+// Worker contexts stage into blocks of at least this size.
+const uint32_t stagingBlockSize = 4194304; // 4MiB
+
+size_t alignUp(size_t value, size_t alignment) {
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
 #pragma mark - Lifecycle
 
 Renderer::Renderer(const RendererInfo &rendererInfo) {
@@ -74,9 +128,27 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
     bool enableMarkers    = rendererInfo.trace;
 
     swapchainInfo = wantedSwapchainInfo = rendererInfo.swapchainInfo;
+    renderOnDemand = rendererInfo.renderOnDemand;
+
+    unsigned int framesInFlight = rendererInfo.framesInFlight;
+    if (framesInFlight == 0) { framesInFlight = swapchainInfo.imageCount; }
+    assert(framesInFlight > 0);
+    frames.resize(framesInFlight);
+    frameTimes.resize(frameTimeWindow, 0.0f);
+    recordingFrame().number = currentFrame;
+
+    assert(rendererInfo.bufferPoolBlockSize <= UINT32_MAX);
+    bufferPoolBlockSize  = rendererInfo.bufferPoolBlockSize;
+    asyncUploadThreshold = rendererInfo.asyncUploadThreshold;
+    uploadBytesPerFrame  = rendererInfo.uploadBytesPerFrame;
 
     delegate = rendererInfo.delegate;
 
+    if (rendererInfo.instrumentHostAllocations) {
+        hostAllocator       = std::make_unique<HostAllocator>();
+        allocationCallbacks = hostAllocator->getCallbacks();
+    }
+
     vk::ApplicationInfo appInfo;
     appInfo.pApplicationName = rendererInfo.appName.data();
     appInfo.applicationVersion =
@@ -91,6 +163,25 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
 
     std::vector<const char *> layers = {"VK_LAYER_LUNARG_standard_validation"};
 
+    // Needed to query VK_EXT_memory_budget, should the device have it.
+    bool properties2 = false;
+    // Needed by VK_EXT_external_memory_host, likewise.
+    bool externalMemory = false;
+    for (const auto &ext : vk::enumerateInstanceExtensionProperties()) {
+        if (std::string(ext.extensionName)
+            == VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) {
+            extensions.push_back(
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            properties2 = true;
+        }
+        if (std::string(ext.extensionName)
+            == VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME) {
+            extensions.push_back(
+                VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+            externalMemory = true;
+        }
+    }
+
     if (enableValidation) {
         extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
         instanceCreateInfo.enabledLayerCount   = layers.size();
@@ -103,7 +194,7 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
     instanceCreateInfo.enabledExtensionCount   = extensions.size();
     instanceCreateInfo.ppEnabledExtensionNames = extensions.data();
 
-    instance = vk::createInstance(instanceCreateInfo);
+    instance = vk::createInstance(instanceCreateInfo, allocationCallbacks);
 
     if (enableValidation) {
         LOG_F(INFO, "Enabling validation layers...");
@@ -118,7 +209,8 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
         callbackInfo.flags = vk::DebugReportFlagBitsEXT::eError
                              | vk::DebugReportFlagBitsEXT::eWarning;
         callbackInfo.pfnCallback = debugCallbackFunc;
-        debugCallback = instance.createDebugReportCallbackEXT(callbackInfo);
+        debugCallback = instance.createDebugReportCallbackEXT(
+            callbackInfo, allocationCallbacks);
     }
 
     if (enableMarkers) {
@@ -133,7 +225,7 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
 
     if (physicalDevices.empty()) {
         LOG_F(ERROR, "No physical Vulkan devices available.");
-        instance.destroy();
+        instance.destroy(allocationCallbacks);
         instance = nullptr;
         throw std::runtime_error("No physical Vulkan devices available.");
     }
@@ -194,6 +286,37 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
               memoryProperties.memoryHeaps[i].size >> 30, tempString.c_str());
     }
 
+    if (rendererInfo.directBufferWrites) {
+        // Only worth it if the host visible device local memory is in the
+        // largest device local heap, as on integrated and software devices or
+        // with resizable BAR. Otherwise it is the 256MiB BAR window, which
+        // is no place for geometry.
+        vk::DeviceSize largestHeap = 0;
+        for (unsigned int i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+            const auto &heap = memoryProperties.memoryHeaps[i];
+            if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+                largestHeap = std::max(largestHeap, heap.size);
+            }
+        }
+
+        auto wanted = vk::MemoryPropertyFlagBits::eDeviceLocal
+                      | vk::MemoryPropertyFlagBits::eHostVisible
+                      | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+        for (unsigned int i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+            const auto &type = memoryProperties.memoryTypes[i];
+            const auto &heap = memoryProperties.memoryHeaps[type.heapIndex];
+
+            if ((type.propertyFlags & wanted) == wanted
+                && heap.size == largestHeap) {
+                directWriteMemoryTypes |= 1u << i;
+            }
+        }
+    }
+
+    LOG_F(INFO, "Buffer contents are %s",
+          directWriteMemoryTypes ? "written directly" : "staged");
+
     std::vector<vk::QueueFamilyProperties> queueProperties =
         physicalDevice.getQueueFamilyProperties();
     LOG_F(INFO, "Queue families: ");
@@ -226,6 +349,10 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
 
     LOG_F(INFO, "Using queue %u for graphics.", graphicsQueueIndex);
 
+    timestampValidBits =
+        queueProperties.at(graphicsQueueIndex).timestampValidBits;
+    timestampPeriod = deviceProperties.limits.timestampPeriod;
+
     std::array<float, 1>                     queuePriorities = {{0.0f}};
     std::array<vk::DeviceQueueCreateInfo, 2> queueCreateInfos;
 
@@ -299,6 +426,66 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
         debugMarkers = checkExtension(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
     }
 
+#ifdef VK_EXT_memory_budget
+    if (properties2) {
+        memoryBudgetExtension =
+            checkExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+#endif
+
+    if (memoryBudgetExtension) {
+        pfn_vkGetPhysicalDeviceMemoryProperties2KHR =
+            reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+                instance.getProcAddr(
+                    "vkGetPhysicalDeviceMemoryProperties2KHR"));
+        memoryBudgetExtension =
+            pfn_vkGetPhysicalDeviceMemoryProperties2KHR != nullptr;
+    }
+
+#ifdef VK_EXT_external_memory_host
+    if (properties2 && externalMemory) {
+        hostMemoryImport =
+            checkExtension(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME)
+            && checkExtension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+    // The extension alone is not enough; the feature has to be enabled.
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+    timelineFeatures.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+    auto pfn_vkGetPhysicalDeviceFeatures2KHR =
+        reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+            instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR"));
+
+    if (properties2 && pfn_vkGetPhysicalDeviceFeatures2KHR
+        && availableExtensions.count(
+               VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2KHR features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features.pNext = &timelineFeatures;
+        pfn_vkGetPhysicalDeviceFeatures2KHR(physicalDevice, &features);
+
+        timelineSemaphores =
+            timelineFeatures.timelineSemaphore
+            && checkExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+#endif
+
+    memoryBudget = rendererInfo.memoryBudget;
+
+    defragmentationMicroseconds  = rendererInfo.defragmentationMicroseconds;
+    defragmentationBytesPerFrame = rendererInfo.defragmentationBytesPerFrame;
+
+    targetFrameTime    = rendererInfo.targetFrameTime;
+    maxResolutionScale = rendererInfo.maxResolutionScale;
+    minResolutionScale =
+        std::min(rendererInfo.minResolutionScale, maxResolutionScale);
+    resolutionScale = maxResolutionScale;
+    assert(minResolutionScale > 0.0f);
+
     vk::DeviceCreateInfo deviceCreateInfo;
     assert(queueCount <= queueCreateInfos.size());
     deviceCreateInfo.queueCreateInfoCount    = queueCount;
@@ -311,11 +498,36 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
         deviceCreateInfo.ppEnabledLayerNames = layers.data();
     }
 
-    device = physicalDevice.createDevice(deviceCreateInfo);
+#ifdef VK_KHR_timeline_semaphore
+    if (timelineSemaphores) {
+        timelineFeatures.pNext = nullptr;
+        deviceCreateInfo.pNext = &timelineFeatures;
+    }
+#endif
+
+    device = physicalDevice.createDevice(deviceCreateInfo, allocationCallbacks);
+
+#ifdef VK_KHR_timeline_semaphore
+    if (timelineSemaphores) {
+        pfn_vkGetSemaphoreCounterValueKHR =
+            reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+                device.getProcAddr("vkGetSemaphoreCounterValueKHR"));
+        pfn_vkWaitSemaphoresKHR = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+            device.getProcAddr("vkWaitSemaphoresKHR"));
+
+        timelineSemaphores = pfn_vkGetSemaphoreCounterValueKHR != nullptr
+                             && pfn_vkWaitSemaphoresKHR != nullptr;
+    }
+#endif
+
+    LOG_F(INFO, "Synchronizing with %s.",
+          timelineSemaphores ? "timeline semaphores" : "fences");
 
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.physicalDevice         = physicalDevice;
     allocatorInfo.device                 = device;
+    allocatorInfo.pAllocationCallbacks =
+        reinterpret_cast<const VkAllocationCallbacks *>(allocationCallbacks);
     if (dedicatedAllocation) {
         LOG_F(INFO, "Dedicated allocations are enabled (with VMA).");
         allocatorInfo.flags = VMA_ALLOCATOR_CREATE_KHR_DEDICATED_ALLOCATION_BIT;
@@ -323,6 +535,37 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
 
     vmaCreateAllocator(&allocatorInfo, &allocator);
 
+#ifdef VK_EXT_external_memory_host
+    if (hostMemoryImport) {
+        pfn_vkGetMemoryHostPointerPropertiesEXT =
+            reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+                device.getProcAddr("vkGetMemoryHostPointerPropertiesEXT"));
+        auto pfn_vkGetPhysicalDeviceProperties2KHR =
+            reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+                instance.getProcAddr("vkGetPhysicalDeviceProperties2KHR"));
+
+        if (pfn_vkGetPhysicalDeviceProperties2KHR) {
+            VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+            hostProperties.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+            VkPhysicalDeviceProperties2KHR properties = {};
+            properties.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+            properties.pNext = &hostProperties;
+
+            pfn_vkGetPhysicalDeviceProperties2KHR(physicalDevice, &properties);
+            hostPointerAlignment =
+                hostProperties.minImportedHostPointerAlignment;
+        }
+
+        hostMemoryImport = pfn_vkGetMemoryHostPointerPropertiesEXT != nullptr
+                           && hostPointerAlignment != 0;
+        LOG_F(INFO, "Host memory import alignment: %llu",
+              static_cast<unsigned long long>(hostPointerAlignment));
+    }
+#endif
+
     graphicsQueue = device.getQueue(graphicsQueueIndex, 0);
     transferQueue = device.getQueue(transferQueueIndex, 0);
 
@@ -351,14 +594,79 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
     // Note: MSAA sampling would go here.
 
     recreateSwapchain();
+    updateResolutionScale();
     recreateRingBuffer(rendererInfo.ringBufferSize);
 
-    acquireSemaphore  = device.createSemaphore(vk::SemaphoreCreateInfo());
-    finishedSemaphore = device.createSemaphore(vk::SemaphoreCreateInfo());
+    // Frame command buffers are reset along with their pool, when the
+    // frame's slot is reused.
+    vk::CommandPoolCreateInfo framePoolInfo;
+    framePoolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    framePoolInfo.queueFamilyIndex = graphicsQueueIndex;
+
+    unsigned int recordingThreads = rendererInfo.recordingThreads;
+    if (recordingThreads == 0) {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        recordingThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+    recordingPool = std::make_unique<ThreadPool>(recordingThreads);
+    LOG_F(INFO, "Recording on %u threads.", recordingPool->size());
+
+    for (auto &frame : frames) {
+        frame.commandPool =
+            device.createCommandPool(framePoolInfo, allocationCallbacks);
+
+        frame.threadCommands.resize(recordingPool->size());
+        for (auto &commands : frame.threadCommands) {
+            commands.commandPool =
+                device.createCommandPool(framePoolInfo, allocationCallbacks);
+        }
+
+        vk::CommandBufferAllocateInfo info;
+        info.commandPool        = frame.commandPool;
+        info.level              = vk::CommandBufferLevel::ePrimary;
+        info.commandBufferCount = 2;
+        auto commandBuffers     = device.allocateCommandBuffers(info);
+        frame.commandBuffer     = commandBuffers.at(0);
+        frame.copyCommandBuffer = commandBuffers.at(1);
+
+        if (!timelineSemaphores) {
+            frame.fence = device.createFence(vk::FenceCreateInfo(),
+                                             allocationCallbacks);
+        }
+        frame.acquireSemaphore = device.createSemaphore(
+            vk::SemaphoreCreateInfo(), allocationCallbacks);
+        frame.finishedSemaphore = device.createSemaphore(
+            vk::SemaphoreCreateInfo(), allocationCallbacks);
+    }
+
+    if (timelineSemaphores) {
+        frameTimeline  = createTimelineSemaphore();
+        uploadTimeline = createTimelineSemaphore();
+    }
+
+    if (timestampValidBits != 0) {
+        vk::QueryPoolCreateInfo queryPoolInfo;
+        queryPoolInfo.queryType  = vk::QueryType::eTimestamp;
+        queryPoolInfo.queryCount = 2 * static_cast<uint32_t>(frames.size());
+        timestampPool =
+            device.createQueryPool(queryPoolInfo, allocationCallbacks);
+    } else {
+        LOG_F(INFO, "No timestamps; resolution scale stays fixed.");
+    }
 
+    // Upload command buffers are recycled along with their UploadOps.
     vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
     poolInfo.queueFamilyIndex = transferQueueIndex;
-    transferCommandPool       = device.createCommandPool(poolInfo);
+    transferCommandPool =
+        device.createCommandPool(poolInfo, allocationCallbacks);
+
+    if (rendererInfo.stagingRingSize != 0) {
+        assert(rendererInfo.stagingRingSize <= UINT32_MAX);
+        stagingRing.buffer = createStagingBuffer(
+            static_cast<uint32_t>(rendererInfo.stagingRingSize),
+            &stagingRing.mapping);
+    }
 
     // TODO: USE A PIPELINE CACHE!!! But this is trickier on mobile,
     // probably requires a delegate function to inform it where to look.
@@ -376,13 +684,20 @@ Renderer::Renderer(const RendererInfo &rendererInfo) {
 }
 
 void Renderer::deleteBufferInternal(Buffer &b) {
-    assert(b.allocationType != BufferAllocationType::Default);
+    // Ring allocations are reclaimed with the ring, not individually.
+    assert(b.allocationType != BufferAllocationType::Ring);
     assert(b.lastUsedFrame <= lastSyncedFrame);
-    this->device.destroyBuffer(b.buffer);
-    assert(b.memory != nullptr);
-    vmaFreeMemory(this->allocator, b.memory);
     assert(b.type != BufferType::Invalid);
 
+    if (b.allocationType == BufferAllocationType::Pooled) {
+        freePooledBuffer(b);
+    } else {
+        this->device.destroyBuffer(b.buffer, allocationCallbacks);
+        assert(b.memory != nullptr);
+        vmaFreeMemory(this->allocator, b.memory);
+        dedicatedFreed = true;
+    }
+
     b.buffer         = vk::Buffer();
     b.allocationType = BufferAllocationType::Default;
     b.memory         = nullptr;
@@ -392,7 +707,61 @@ void Renderer::deleteBufferInternal(Buffer &b) {
     b.type           = BufferType::Invalid;
 }
 
-void Renderer::recreateSwapchain() {
+void Renderer::deleteResourceInternal(Resource &r) {
+    std::visit(ResourceDeleter(this), r);
+}
+
+size_t resourceSize(const Resource &r) {
+    return std::visit([](const auto &resource) -> size_t {
+        return resource.size;
+    }, r);
+}
+
+void Renderer::retireResource(Resource &&r) {
+    graveyardBytes += resourceSize(r);
+
+    // The slot was claimed for currentFrame, so whatever it held before has
+    // already been collected.
+    Frame &frame = recordingFrame();
+    assert(frame.number == currentFrame);
+    frame.deletions.emplace_back(std::move(r));
+}
+
+void Renderer::collectGraveyard() {
+    for (auto &frame : frames) {
+        if (frame.deletions.empty() || frame.number > lastSyncedFrame) {
+            continue;
+        }
+
+        for (auto &r : frame.deletions) {
+            graveyardBytes -= resourceSize(r);
+            deleteResourceInternal(r);
+        }
+
+        // Keeps capacity, so steady-state deletion does not allocate.
+        frame.deletions.clear();
+    }
+
+    // Acquired in submission order, so these are in frame order.
+    auto it = acquiredUploads.begin();
+    for (; it != acquiredUploads.end() && it->frame <= lastSyncedFrame; ++it) {
+        recycleUploadOp(it->op);
+        freeUploadOps.emplace_back(std::move(it->op));
+    }
+    acquiredUploads.erase(acquiredUploads.begin(), it);
+
+    // Likewise in frame order.
+    auto file = importedFiles.begin();
+    for (; file != importedFiles.end() && file->frame <= lastSyncedFrame;
+         ++file) {
+        device.destroyBuffer(file->buffer, allocationCallbacks);
+        device.freeMemory(file->memory, allocationCallbacks);
+        munmap(file->mapping, file->length);
+    }
+    importedFiles.erase(importedFiles.begin(), file);
+}
+
+bool Renderer::recreateSwapchain() {
     LOG_SCOPE_F(INFO, "Recreating swapchain");
 
     assert(isSwapchainDirty);
@@ -418,12 +787,18 @@ void Renderer::recreateSwapchain() {
 
     auto [tempW, tempH] = delegate.getFramebufferSize();
 
-    if (tempW <= 0 || tempH <= 0) {
+    if (tempW < 0 || tempH < 0) {
         // This really should not happen...
         throw std::runtime_error(
             "Delegate returned negative framebuffer size.");
     }
 
+    // Minimized; try again once there is something to see.
+    if (tempW == 0 || tempH == 0) {
+        LOG_F(INFO, "Framebuffer is empty, deferring");
+        return false;
+    }
+
     // Some window managers will not actually return the resized
     // dimensions yet, so we have to be ready to improvise.
     unsigned int w =
@@ -432,10 +807,168 @@ void Renderer::recreateSwapchain() {
                           surfaceCapabilities.maxImageExtent.width));
     unsigned int h =
         std::max(surfaceCapabilities.minImageExtent.height,
-                 std::min(static_cast<unsigned int>(tempW),
+                 std::min(static_cast<unsigned int>(tempH),
                           surfaceCapabilities.maxImageExtent.height));
 
+    // Otherwise the surface dictates the size.
+    if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
+        w = surfaceCapabilities.currentExtent.width;
+        h = surfaceCapabilities.currentExtent.height;
+    }
+
+    if (w == 0 || h == 0) {
+        LOG_F(INFO, "Surface is empty, deferring");
+        return false;
+    }
+
     framebufferSize = {w, h};
+
+    presentMode = choosePresentMode(wantedSwapchainInfo.presentMode);
+    LOG_F(INFO, "Present mode: %s", vk::to_string(presentMode).c_str());
+
+    unsigned int imageCount = std::max(surfaceCapabilities.minImageCount,
+                                       wantedSwapchainInfo.imageCount);
+    if (surfaceCapabilities.maxImageCount != 0) {
+        imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+    }
+
+    vk::CompositeAlphaFlagBitsKHR compositeAlpha =
+        vk::CompositeAlphaFlagBitsKHR::eOpaque;
+    for (auto alpha : {vk::CompositeAlphaFlagBitsKHR::eOpaque,
+                       vk::CompositeAlphaFlagBitsKHR::eInherit,
+                       vk::CompositeAlphaFlagBitsKHR::ePreMultiplied,
+                       vk::CompositeAlphaFlagBitsKHR::ePostMultiplied}) {
+        if (surfaceCapabilities.supportedCompositeAlpha & alpha) {
+            compositeAlpha = alpha;
+            break;
+        }
+    }
+
+    swapchainFormat = chooseSurfaceFormat();
+    swapchainExtent = vk::Extent2D(w, h);
+
+    vk::SwapchainCreateInfoKHR info;
+    info.surface          = surface;
+    info.minImageCount    = imageCount;
+    info.imageFormat      = swapchainFormat;
+    info.imageColorSpace  = vk::ColorSpaceKHR::eSrgbNonlinear;
+    info.imageExtent      = swapchainExtent;
+    info.imageArrayLayers = 1;
+    info.imageUsage       = vk::ImageUsageFlagBits::eColorAttachment;
+    info.imageSharingMode = vk::SharingMode::eExclusive;
+    info.preTransform     = surfaceCapabilities.currentTransform;
+    info.compositeAlpha   = compositeAlpha;
+    info.presentMode      = presentMode;
+    info.clipped          = VK_TRUE;
+
+    // Lets the presentation engine hand resources over, and keeps frames
+    // in flight presenting from the old swapchain valid.
+    info.oldSwapchain = swapchain;
+
+    swapchainTransferDestination =
+        static_cast<bool>(surfaceCapabilities.supportedUsageFlags
+                          & vk::ImageUsageFlagBits::eTransferDst);
+    if (swapchainTransferDestination) {
+        info.imageUsage |= vk::ImageUsageFlagBits::eTransferDst;
+    } else {
+        LOG_F(WARNING, "Swapchain images cannot be blitted into; "
+                       "rendering at full resolution.");
+    }
+
+    vk::SwapchainKHR newSwapchain =
+        device.createSwapchainKHR(info, allocationCallbacks);
+
+    // Rather than wait for the device to go idle, the old swapchain is
+    // destroyed once the frames that may present from it are synced.
+    if (swapchain) {
+        RetiredSwapchain retired;
+        retired.swapchain  = swapchain;
+        retired.imageViews = std::move(swapchainImageViews);
+        retireResource(std::move(retired));
+    }
+
+    swapchain = newSwapchain;
+    swapchainImages = device.getSwapchainImagesKHR(swapchain);
+
+    swapchainImageViews.clear();
+    for (auto image : swapchainImages) {
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.image                       = image;
+        viewInfo.viewType                    = vk::ImageViewType::e2D;
+        viewInfo.format                      = swapchainFormat;
+        viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        swapchainImageViews.push_back(
+            device.createImageView(viewInfo, allocationCallbacks));
+    }
+
+    // Queueing and pacing settings carry over, they apply immediately.
+    swapchainInfo            = wantedSwapchainInfo;
+    swapchainInfo.width      = w;
+    swapchainInfo.height     = h;
+    swapchainInfo.imageCount = static_cast<unsigned int>(
+        swapchainImages.size());
+
+    LOG_F(INFO, "Swapchain: %ux%u %s, %u images", w, h,
+          vk::to_string(swapchainFormat).c_str(), swapchainInfo.imageCount);
+
+    isSwapchainDirty = false;
+    return true;
+}
+
+vk::Format Renderer::chooseSurfaceFormat() const {
+    // A lone undefined format means the surface takes any.
+    if (surfaceFormats.empty()
+        || (surfaceFormats.size() == 1
+            && surfaceFormats.count(vk::Format::eUndefined))) {
+        return vk::Format::eB8G8R8A8Srgb;
+    }
+
+    for (auto format : {vk::Format::eB8G8R8A8Srgb, vk::Format::eR8G8B8A8Srgb,
+                        vk::Format::eB8G8R8A8Unorm,
+                        vk::Format::eR8G8B8A8Unorm}) {
+        if (surfaceFormats.count(format)) return format;
+    }
+
+    return *surfaceFormats.begin();
+}
+
+void Renderer::deleteSwapchainInternal(RetiredSwapchain &s) {
+    for (auto view : s.imageViews) {
+        device.destroyImageView(view, allocationCallbacks);
+    }
+    s.imageViews.clear();
+
+    device.destroySwapchainKHR(s.swapchain, allocationCallbacks);
+    s.swapchain = vk::SwapchainKHR();
+}
+
+vk::PresentModeKHR Renderer::choosePresentMode(PresentMode mode) const {
+    using Mode = vk::PresentModeKHR;
+
+    std::array<Mode, 3> preferences;
+    switch (mode) {
+    case PresentMode::Fifo: preferences = {{Mode::eFifo}}; break;
+    case PresentMode::FifoRelaxed:
+        preferences = {{Mode::eFifoRelaxed, Mode::eFifo}};
+        break;
+    case PresentMode::Mailbox:
+        preferences = {{Mode::eMailbox, Mode::eImmediate, Mode::eFifo}};
+        break;
+    case PresentMode::Immediate:
+        preferences = {{Mode::eImmediate, Mode::eMailbox, Mode::eFifo}};
+        break;
+    }
+
+    // Each list ends with Fifo; what follows it is padding.
+    for (auto preference : preferences) {
+        if (surfacePresentModes.count(preference)) return preference;
+        if (preference == Mode::eFifo) break;
+    }
+
+    // Every surface supports it.
+    return Mode::eFifo;
 }
 
 void Renderer::recreateRingBuffer(unsigned int newSize) {
@@ -446,7 +979,7 @@ void Renderer::recreateRingBuffer(unsigned int newSize) {
     // Clear any existing buffer.
     if (ringBuffer) {
         assert(ringBufferSize > 0);
-        assert(!persistentMapping);
+        assert(persistentMapping);
 
         // To keep resource management consistent, we wrap up the details
         // of our 'main' buffer in a Buffer object, and emplace it on the
@@ -466,14 +999,24 @@ void Renderer::recreateRingBuffer(unsigned int newSize) {
         ringBufferSize = 0;
 
         buffer.type      = BufferType::Any;
-        buffer.offset    = ringBufferOffset;
+        buffer.offset    = 0;
         ringBufferOffset = 0;
 
+        // Everything in flight refers to the old ring, so the new one starts
+        // out entirely free.
+        lastSyncedRingBufferIndex = 0;
+        for (auto &frame : frames) { frame.ringBufferEnd = 0; }
+
         buffer.lastUsedFrame = currentFrame;
 
-        graveyard.emplace(std::move(buffer));
+        retireResource(std::move(buffer));
     }
 
+    // Keep the ring a multiple of every alignment we hand out, so that
+    // aligned offsets stay aligned when taken modulo its size. 256 is the
+    // largest alignment the spec allows for uniform and storage buffers.
+    newSize = static_cast<unsigned int>(alignUp(newSize, 256));
+
     assert(!ringBuffer);
     assert(ringBufferSize == 0);
     assert(ringBufferOffset == 0);
@@ -487,7 +1030,7 @@ void Renderer::recreateRingBuffer(unsigned int newSize) {
                        | vk::BufferUsageFlagBits::eIndexBuffer
                        | vk::BufferUsageFlagBits::eVertexBuffer
                        | vk::BufferUsageFlagBits::eTransferSrc;
-    ringBuffer = device.createBuffer(bufferInfo);
+    ringBuffer = device.createBuffer(bufferInfo, allocationCallbacks);
 
     assert(ringBufferMemory == nullptr);
 
@@ -499,6 +1042,10 @@ void Renderer::recreateRingBuffer(unsigned int newSize) {
     requestInfo.usage     = VMA_MEMORY_USAGE_CPU_TO_GPU;
     requestInfo.pUserData = const_cast<char *>("Ring Buffer");
 
+    // Writes through the persistent mapping are never explicitly flushed.
+    requestInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
     VmaAllocationInfo allocationInfo = {};
 
     auto result =
@@ -526,67 +1073,76 @@ void Renderer::recreateRingBuffer(unsigned int newSize) {
     assert(persistentMapping != nullptr);
 }
 
-Renderer::~Renderer() {
-
-    // TODO: should write out pipeline cache here (!)
-
-    device.destroySemaphore(finishedSemaphore);
-    finishedSemaphore = vk::Semaphore();
+unsigned int Renderer::ringBufferAllocate(unsigned int size,
+                                          unsigned int alignment) {
+    assert(size > 0);
+    assert(ringBuffer);
 
-    device.destroySemaphore(acquireSemaphore);
-    acquireSemaphore = vk::Semaphore();
+    size_t begin    = alignUp(ringBufferOffset, alignment);
+    size_t position = begin % ringBufferSize;
 
-    vmaFreeMemory(allocator, ringBufferMemory);
-    ringBufferMemory  = nullptr;
-    persistentMapping = nullptr;
-    device.destroyBuffer(ringBuffer);
-    ringBuffer = vk::Buffer();
+    // Allocations never straddle the end of the ring; skip to the start.
+    if (position + size > ringBufferSize) {
+        begin += ringBufferSize - position;
+        position = 0;
+    }
 
-    // destroy swapchain
-    device.destroySwapchainKHR(swapchain);
-    swapchain = vk::SwapchainKHR();
+    size_t end = begin + size;
 
-    instance.destroySurfaceKHR(surface);
-    surface = vk::SurfaceKHR();
+    // The GPU may still be reading what we would overwrite. Each frame's
+    // part of the ring is free once it is synced, so wrap around by
+    // waiting for the oldest frames in flight until enough has been freed.
+    if (end - lastSyncedRingBufferIndex > ringBufferSize) { pollFrames(); }
 
-    vmaDestroyAllocator(allocator);
-    allocator = nullptr;
+    while (end - lastSyncedRingBufferIndex > ringBufferSize
+           && lastSyncedFrame + 1 < currentFrame) {
+        uint32_t frame = lastSyncedFrame + 1;
+        VLOG_F(1, "Ring buffer full, waiting for frame %u", frame);
+        waitForFrame(frame);
+        markFrameSynced(frame);
+    }
 
-    device.destroyCommandPool(transferCommandPool);
-    transferCommandPool = vk::CommandPool();
+    if (end - lastSyncedRingBufferIndex > ringBufferSize) {
+        // The frame being recorded needs more than the whole ring. Retire
+        // this ring to the graveyard and continue in a larger one; the old
+        // ring is freed once the frames using it are synced.
+        size_t newSize = ringBufferSize * 2;
+        while (newSize < size + alignment) { newSize *= 2; }
 
-    device.destroy();
-    device = vk::Device();
+        LOG_F(INFO, "Ring buffer exhausted, growing from %zu to %zu bytes",
+              ringBufferSize, newSize);
 
-    if (debugCallback) {
-        instance.destroyDebugReportCallbackEXT(debugCallback);
-        debugCallback = vk::DebugReportCallbackEXT();
+        recreateRingBuffer(static_cast<unsigned int>(newSize));
+        return ringBufferAllocate(size, alignment);
     }
 
-    instance.destroy();
-    instance = vk::Instance();
-}
+    ringBufferOffset = end;
 
-#pragma mark - Resource Management
+    return static_cast<unsigned int>(position);
+}
 
-BufferHandle
-Renderer::createBuffer(BufferType type, uint32_t size, const void *contents) {
-    // Note: this method looks a lot like the code to recreate our ringbuffer,
-    // but this is intended for public usage, e.g. for vertex and index buffers.
-    // Do not attempt to use this code to manage the ringbuffer.
-    LOG_SCOPE_F(INFO, "Creating a %s buffer of size %u",
-                bufferTypeString(type).c_str(), size);
+unsigned int Renderer::bufferAlignment(BufferType type) const {
+    // Used for both ring and pooled sub-allocations.
+    switch (type) {
+    case BufferType::Invalid: UNREACHABLE();
+    case BufferType::Uniform: return static_cast<unsigned int>(uboAlignment);
+    case BufferType::Any: return static_cast<unsigned int>(ssboAlignment);
 
-    assert(type != BufferType::Invalid);
-    assert(size != 0);
-    assert(contents != nullptr);
+    // Vertex and index data only need natural alignment; 16 keeps vec4
+    // attributes aligned as well.
+    case BufferType::Vertex:
+    case BufferType::Index: return 16;
+    }
+}
 
+uint8_t *Renderer::allocateDedicatedBuffer(Buffer &   b,
+                                           BufferType type,
+                                           uint32_t   size) {
     vk::BufferCreateInfo info;
     info.size  = size;
     info.usage = bufferTypeUsageFlags(type);
 
-    auto [buffer, bufferHandle] = buffers.add();
-    buffer.buffer               = device.createBuffer(info);
+    b.buffer = device.createBuffer(info, allocationCallbacks);
 
     // Note: you do need to initialize these with = {},
     // as they are C structures and we want them zero-initialized.
@@ -594,8 +1150,35 @@ Renderer::createBuffer(BufferType type, uint32_t size, const void *contents) {
     requestInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
     VmaAllocationInfo allocationInfo    = {};
 
-    vmaAllocateMemoryForBuffer(allocator, buffer.buffer, &requestInfo,
-                               &buffer.memory, &allocationInfo);
+    VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    if (directWriteMemoryTypes) {
+        VmaAllocationCreateInfo directInfo = requestInfo;
+        directInfo.flags                   = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        directInfo.memoryTypeBits          = directWriteMemoryTypes;
+
+        result = vmaAllocateMemoryForBuffer(allocator, b.buffer, &directInfo,
+                                            &b.memory, &allocationInfo);
+
+        // Those memory types may be full while others are not.
+        if (result != VK_SUCCESS) {
+            LOG_F(WARNING, "Falling back to staging: %s",
+                  vk::to_string(vk::Result(result)).c_str());
+        }
+    }
+
+    if (result != VK_SUCCESS) {
+        result = vmaAllocateMemoryForBuffer(allocator, b.buffer, &requestInfo,
+                                            &b.memory, &allocationInfo);
+    }
+
+    if (result != VK_SUCCESS) {
+        device.destroyBuffer(b.buffer, allocationCallbacks);
+        b.buffer = vk::Buffer();
+        LOG_F(ERROR, "vmaAllocateMemoryForBuffer failed: %s",
+              vk::to_string(vk::Result(result)).c_str());
+        throw std::runtime_error("vmaAllocateMemoryForBuffer failed");
+    }
     LOG_F(INFO, "Buffer Memory Type: %u", allocationInfo.memoryType);
     LOG_F(INFO, "Buffer Memory Offset: %u",
           static_cast<unsigned int>(allocationInfo.offset));
@@ -603,25 +1186,2571 @@ Renderer::createBuffer(BufferType type, uint32_t size, const void *contents) {
           static_cast<unsigned int>(allocationInfo.size));
 
     assert(allocationInfo.size > 0);
-    assert(allocationInfo.pMappedData == nullptr);
 
-    device.bindBufferMemory(buffer.buffer, allocationInfo.deviceMemory,
+    device.bindBufferMemory(b.buffer, allocationInfo.deviceMemory,
                             allocationInfo.offset);
 
-    buffer.offset = static_cast<uint32_t>(allocationInfo.offset);
-    buffer.size = size;
-    buffer.type = type;
+    // Buffer::offset is where the data starts within b.buffer, which for a
+    // dedicated buffer is always the beginning; the memory offset is VMA's
+    // business.
+    b.offset         = 0;
+    b.allocationType = BufferAllocationType::Default;
 
-    // Copy to GPU.
-    // TODO: HERE!
+    return reinterpret_cast<uint8_t *>(allocationInfo.pMappedData);
+}
 
-    return bufferHandle;
+bool Renderer::isPooled(BufferType type, uint32_t size) const {
+    return bufferPoolBlockSize != 0 && size <= bufferPoolBlockSize
+           && (type == BufferType::Vertex || type == BufferType::Index);
 }
 
-void Renderer::deleteBuffer(BufferHandle handle) {
-    buffers.removeWith(std::move(handle), [this](Buffer &b) {
-        this->graveyard.emplace(std::move(b));
-    });
+Renderer::BufferPool &Renderer::bufferPool(BufferType type) {
+    switch (type) {
+    case BufferType::Vertex: return vertexPool;
+    case BufferType::Index: return indexPool;
+    default: UNREACHABLE();
+    }
+}
+
+uint8_t *
+Renderer::allocatePooledBuffer(Buffer &b, BufferType type, uint32_t size) {
+    assert(size <= bufferPoolBlockSize);
+
+    BufferPool & pool      = bufferPool(type);
+    unsigned int alignment = bufferAlignment(type);
+    uint32_t     offset    = 0;
+
+    auto it = pool.blocks.begin();
+    for (; it != pool.blocks.end(); ++it) {
+        if (it->buffer == pool.evacuating) continue;
+        if (it->allocator.allocate(size, alignment, offset)) break;
+    }
+
+    if (it == pool.blocks.end()) {
+        LOG_F(INFO, "Adding a %zu byte block to the %s buffer pool",
+              bufferPoolBlockSize, bufferTypeString(type).c_str());
+
+        BufferPool::Block block;
+
+        // Transfer usage lets defragmentation move data between blocks.
+        vk::BufferCreateInfo info;
+        info.size  = bufferPoolBlockSize;
+        info.usage = bufferTypeUsageFlags(type)
+                     | vk::BufferUsageFlagBits::eTransferSrc
+                     | vk::BufferUsageFlagBits::eTransferDst;
+        block.buffer = device.createBuffer(info, allocationCallbacks);
+
+        VmaAllocationCreateInfo requestInfo = {};
+        requestInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        requestInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        VmaAllocationInfo allocationInfo = {};
+
+        VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+        if (directWriteMemoryTypes) {
+            VmaAllocationCreateInfo directInfo = requestInfo;
+            directInfo.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            directInfo.memoryTypeBits = directWriteMemoryTypes;
+
+            result = vmaAllocateMemoryForBuffer(allocator, block.buffer,
+                                                &directInfo, &block.memory,
+                                                &allocationInfo);
+        }
+
+        if (result != VK_SUCCESS) {
+            result = vmaAllocateMemoryForBuffer(allocator, block.buffer,
+                                                &requestInfo, &block.memory,
+                                                &allocationInfo);
+        }
+
+        if (result != VK_SUCCESS) {
+            device.destroyBuffer(block.buffer, allocationCallbacks);
+            LOG_F(ERROR, "vmaAllocateMemoryForBuffer failed: %s",
+                  vk::to_string(vk::Result(result)).c_str());
+            throw std::runtime_error("vmaAllocateMemoryForBuffer failed");
+        }
+
+        device.bindBufferMemory(block.buffer, allocationInfo.deviceMemory,
+                                allocationInfo.offset);
+
+        block.mapping = reinterpret_cast<uint8_t *>(allocationInfo.pMappedData);
+        block.allocator =
+            VirtualBlock(static_cast<uint32_t>(bufferPoolBlockSize));
+
+        bool allocated = block.allocator.allocate(size, alignment, offset);
+        assert(allocated);
+
+        pool.blocks.emplace_back(std::move(block));
+        it = std::prev(pool.blocks.end());
+    }
+
+    b.buffer         = it->buffer;
+    b.offset         = offset;
+    b.allocationType = BufferAllocationType::Pooled;
+
+    return it->mapping ? it->mapping + offset : nullptr;
+}
+
+void Renderer::freePooledBuffer(Buffer &b) {
+    BufferPool &pool = bufferPool(b.type);
+
+    auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+                           [&](const BufferPool::Block &block) {
+                               return block.buffer == b.buffer;
+                           });
+    assert(it != pool.blocks.end());
+
+    it->allocator.free(b.offset, b.size);
+
+    // The block being evacuated has drained once its last ranges come out
+    // of the graveyard.
+    if (it->allocator.isEmpty() && it->buffer == pool.evacuating) {
+        pool.evacuating = vk::Buffer();
+    }
+
+    // Only synced allocations are ever freed, so an empty block is not in
+    // use by the GPU and can go right away. Keep one around regardless.
+    if (it->allocator.isEmpty() && pool.blocks.size() > 1) {
+        device.destroyBuffer(it->buffer, allocationCallbacks);
+        vmaFreeMemory(allocator, it->memory);
+        pool.blocks.erase(it);
+    }
+
+    b.memory = nullptr;
+}
+
+void Renderer::destroyBufferPool(BufferPool &pool) {
+    for (auto &block : pool.blocks) {
+        assert(block.allocator.isEmpty());
+        device.destroyBuffer(block.buffer, allocationCallbacks);
+        vmaFreeMemory(allocator, block.memory);
+    }
+    pool.blocks.clear();
+}
+
+void Renderer::markFrameRecorded() {
+    enforceMemoryBudget();
+    defragmentStep();
+    flushWorkerContexts();
+    flushBufferUpdates();
+    streamUploads();
+    submitUploads();
+    submitFrame();
+
+    Frame &frame         = recordingFrame();
+    frame.ringBufferEnd  = ringBufferOffset;
+    frame.stagingRingEnd = stagingRing.offset;
+
+    for (auto &handle : ephemeralBuffers) {
+        buffers.removeWith(handle, [](Buffer &b) {
+            assert(b.allocationType == BufferAllocationType::Ring);
+
+            // The ring owns the memory; just forget the sub-allocation.
+            b.buffer         = vk::Buffer();
+            b.allocationType = BufferAllocationType::Default;
+            b.size           = 0;
+            b.offset         = 0;
+            b.lastUsedFrame  = 0;
+            b.type           = BufferType::Invalid;
+        });
+    }
+    ephemeralBuffers.clear();
+
+    currentFrame++;
+    claimFrame();
+}
+
+#pragma mark - Timelines
+
+vk::Semaphore Renderer::createTimelineSemaphore() {
+    vk::SemaphoreCreateInfo info;
+
+#ifdef VK_KHR_timeline_semaphore
+    VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+    typeInfo.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    typeInfo.initialValue  = 0;
+    info.pNext             = &typeInfo;
+#endif
+
+    assert(timelineSemaphores);
+    return device.createSemaphore(info, allocationCallbacks);
+}
+
+uint64_t Renderer::timelineValue(vk::Semaphore timeline) const {
+    uint64_t value = 0;
+
+#ifdef VK_KHR_timeline_semaphore
+    VkResult result =
+        pfn_vkGetSemaphoreCounterValueKHR(device, timeline, &value);
+    if (result != VK_SUCCESS) {
+        LOG_F(ERROR, "vkGetSemaphoreCounterValueKHR failed: %s",
+              vk::to_string(vk::Result(result)).c_str());
+        throw std::runtime_error("vkGetSemaphoreCounterValueKHR failed");
+    }
+#endif
+
+    return value;
+}
+
+void Renderer::waitForFrame(uint32_t frame) {
+    if (!timelineSemaphores) {
+        const Frame &waited = frames[frame % frames.size()];
+        assert(waited.number == frame);
+        device.waitForFences(waited.fence, VK_TRUE, UINT64_MAX);
+        return;
+    }
+
+#ifdef VK_KHR_timeline_semaphore
+    VkSemaphore semaphore = frameTimeline;
+    uint64_t    value     = frame;
+
+    VkSemaphoreWaitInfoKHR waitInfo = {};
+    waitInfo.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores    = &semaphore;
+    waitInfo.pValues        = &value;
+
+    VkResult result = pfn_vkWaitSemaphoresKHR(device, &waitInfo, UINT64_MAX);
+    if (result != VK_SUCCESS) {
+        LOG_F(ERROR, "vkWaitSemaphoresKHR failed: %s",
+              vk::to_string(vk::Result(result)).c_str());
+        throw std::runtime_error("vkWaitSemaphoresKHR failed");
+    }
+#endif
+}
+
+void Renderer::markFrameSynced(uint32_t frame) {
+    assert(frame < currentFrame);
+
+    if (frame <= lastSyncedFrame) return;
+
+    Frame &synced = frames[frame % frames.size()];
+    assert(synced.number == frame);
+
+    lastSyncedFrame = frame;
+    lastSyncedRingBufferIndex =
+        std::max(lastSyncedRingBufferIndex, synced.ringBufferEnd);
+    stagingRing.synced = std::max(stagingRing.synced, synced.stagingRingEnd);
+
+    readGpuFrameTime(synced);
+    collectGraveyard();
+}
+
+void Renderer::claimFrame() {
+    Frame &frame = recordingFrame();
+
+    if (frame.number != 0) {
+        // Frames are synced in order, and every frame before this one has
+        // had its slot claimed since, so this one fence is all there is to
+        // wait for. With frames to spare it was signaled long ago.
+        if (frame.number > lastSyncedFrame) {
+            waitForFrame(frame.number);
+            markFrameSynced(frame.number);
+        }
+
+        if (frame.fence) { device.resetFences(frame.fence); }
+        frame.timed = false;
+        device.resetCommandPool(frame.commandPool,
+                                vk::CommandPoolResetFlags());
+        for (auto &commands : frame.threadCommands) {
+            if (commands.used == 0) continue;
+            device.resetCommandPool(commands.commandPool,
+                                    vk::CommandPoolResetFlags());
+            commands.used = 0;
+        }
+    }
+
+    frame.number = currentFrame;
+}
+
+void Renderer::pollFrames() {
+    // The counter is the last frame completed, so one query covers them all.
+    if (timelineSemaphores) {
+        markFrameSynced(static_cast<uint32_t>(timelineValue(frameTimeline)));
+        return;
+    }
+
+    // Frames complete in submission order; stop at the first that has not.
+    for (uint32_t number = lastSyncedFrame + 1; number < currentFrame;
+         ++number) {
+        const Frame &frame = frames[number % frames.size()];
+        assert(frame.number == number);
+
+        if (device.getFenceStatus(frame.fence) != vk::Result::eSuccess) {
+            break;
+        }
+        markFrameSynced(number);
+    }
+}
+
+Renderer::~Renderer() {
+
+    // TODO: should write out pipeline cache here (!)
+
+    assert(!recordingFrame().begun);
+
+    // Closes out the partial frame, which releases its ephemeral buffers
+    // and commits whatever the workers created.
+    markFrameRecorded();
+
+    // Everything submitted has completed after this, so all remaining
+    // resources can be destroyed regardless of the frame they were used in.
+    device.waitIdle();
+    lastSyncedFrame = currentFrame;
+
+    destroyWorkerContext(mainContext);
+    for (auto &context : workerContexts) { destroyWorkerContext(*context); }
+    workerContexts.clear();
+
+    buffers.clearWith(ResourceDeleter(this));
+    collectGraveyard();
+
+    for (auto &op : freeUploadOps) { freeUploadOp(op); }
+    freeUploadOps.clear();
+
+    if (stagingRing.mapping) {
+        deleteBufferInternal(stagingRing.buffer);
+        stagingRing.mapping = nullptr;
+    }
+
+    for (auto &block : stagingRing.overflow) {
+        deleteBufferInternal(block.buffer);
+    }
+    stagingRing.overflow.clear();
+
+    destroyBufferPool(vertexPool);
+    destroyBufferPool(indexPool);
+
+    // Destroying the pools frees the command buffers.
+    for (auto &frame : frames) {
+        device.destroyFence(frame.fence, allocationCallbacks);
+        device.destroySemaphore(frame.acquireSemaphore, allocationCallbacks);
+        device.destroySemaphore(frame.finishedSemaphore, allocationCallbacks);
+        device.destroyCommandPool(frame.commandPool, allocationCallbacks);
+        for (auto &commands : frame.threadCommands) {
+            device.destroyCommandPool(commands.commandPool,
+                                      allocationCallbacks);
+        }
+    }
+    frames.clear();
+    recordingPool.reset();
+
+    device.destroyQueryPool(timestampPool, allocationCallbacks);
+    timestampPool = vk::QueryPool();
+
+    // Null without timeline semaphores, which is fine to destroy.
+    device.destroySemaphore(frameTimeline, allocationCallbacks);
+    device.destroySemaphore(uploadTimeline, allocationCallbacks);
+    frameTimeline  = vk::Semaphore();
+    uploadTimeline = vk::Semaphore();
+
+    vmaFreeMemory(allocator, ringBufferMemory);
+    ringBufferMemory  = nullptr;
+    persistentMapping = nullptr;
+    device.destroyBuffer(ringBuffer, allocationCallbacks);
+    ringBuffer = vk::Buffer();
+
+    for (auto view : swapchainImageViews) {
+        device.destroyImageView(view, allocationCallbacks);
+    }
+    swapchainImageViews.clear();
+    swapchainImages.clear();
+
+    device.destroySwapchainKHR(swapchain, allocationCallbacks);
+    swapchain = vk::SwapchainKHR();
+
+    // The delegate created the surface without our allocation callbacks.
+    instance.destroySurfaceKHR(surface);
+    surface = vk::SurfaceKHR();
+
+    vmaDestroyAllocator(allocator);
+    allocator = nullptr;
+
+    device.destroyCommandPool(transferCommandPool, allocationCallbacks);
+    transferCommandPool = vk::CommandPool();
+
+    device.destroy(allocationCallbacks);
+    device = vk::Device();
+
+    if (debugCallback) {
+        instance.destroyDebugReportCallbackEXT(debugCallback,
+                                                allocationCallbacks);
+        debugCallback = vk::DebugReportCallbackEXT();
+    }
+
+    instance.destroy(allocationCallbacks);
+    instance = vk::Instance();
+}
+
+#pragma mark - Resource Management
+
+BufferHandle
+Renderer::createBuffer(BufferType type, uint32_t size, const void *contents) {
+    // Note: this method looks a lot like the code to recreate our ringbuffer,
+    // but this is intended for public usage, e.g. for vertex and index buffers.
+    // Do not attempt to use this code to manage the ringbuffer.
+    LOG_SCOPE_F(INFO, "Creating a %s buffer of size %u",
+                bufferTypeString(type).c_str(), size);
+
+    assert(type != BufferType::Invalid);
+    assert(size != 0);
+    assert(contents != nullptr);
+
+    auto [buffer, bufferHandle] = buffers.add();
+
+    buffer.size          = size;
+    buffer.type          = type;
+    buffer.lastUsedFrame = currentFrame;
+
+    bufferBytes[static_cast<size_t>(type)] += size;
+
+    uint8_t *mapping = isPooled(type, size)
+                           ? allocatePooledBuffer(buffer, type, size)
+                           : allocateDedicatedBuffer(buffer, type, size);
+
+    // Host coherent, and nothing can be using the memory yet.
+    if (mapping) {
+        std::memcpy(mapping, contents, size);
+        return bufferHandle;
+    }
+
+    if (uploadAsync(buffer, contents)) return bufferHandle;
+
+    // Otherwise copied to the GPU when the frame being recorded ends.
+    WorkerContext::Pending pending;
+    pending.handle = bufferHandle;
+    pending.type   = type;
+    pending.size   = size;
+
+    std::lock_guard<std::mutex> lock(mainContext.mutex);
+    stage(mainContext, pending, contents);
+
+    return bufferHandle;
+}
+
+std::vector<BufferHandle>
+Renderer::createBuffers(const std::vector<BufferDesc> &descs) {
+    LOG_SCOPE_F(INFO, "Creating %zu buffers", descs.size());
+
+    std::vector<BufferHandle> handles;
+    handles.reserve(descs.size());
+
+    size_t stagingSize = 0;
+    for (const BufferDesc &desc : descs) {
+        assert(desc.type != BufferType::Invalid);
+        assert(desc.size != 0);
+        assert(desc.contents != nullptr);
+
+        // Large dedicated buffers bring their own, see uploadAsync().
+        if (asyncUploadThreshold != 0 && desc.size >= asyncUploadThreshold
+            && !isPooled(desc.type, desc.size)) {
+            continue;
+        }
+
+        stagingSize = alignUp(stagingSize, 16) + desc.size;
+    }
+
+    std::lock_guard<std::mutex> lock(mainContext.mutex);
+
+    // Everything below then fits in one staging buffer, if it needs one.
+    // A batch too large for a single buffer fills this one, and stage()
+    // starts another for the rest.
+    if (!directWriteMemoryTypes && stagingSize != 0) {
+        size_t reservation = std::min<size_t>(stagingSize + 16, UINT32_MAX);
+        reserveStaging(mainContext, static_cast<uint32_t>(reservation));
+    }
+
+    for (const BufferDesc &desc : descs) {
+
+        auto [buffer, bufferHandle] = buffers.add();
+
+        buffer.size          = desc.size;
+        buffer.type          = desc.type;
+        buffer.lastUsedFrame = currentFrame;
+
+        bufferBytes[static_cast<size_t>(desc.type)] += desc.size;
+
+        uint8_t *mapping =
+            isPooled(desc.type, desc.size)
+                ? allocatePooledBuffer(buffer, desc.type, desc.size)
+                : allocateDedicatedBuffer(buffer, desc.type, desc.size);
+
+        handles.push_back(bufferHandle);
+
+        if (mapping) {
+            std::memcpy(mapping, desc.contents, desc.size);
+            continue;
+        }
+
+        if (uploadAsync(buffer, desc.contents)) continue;
+
+        WorkerContext::Pending pending;
+        pending.handle = bufferHandle;
+        pending.type   = desc.type;
+        pending.size   = desc.size;
+        stage(mainContext, pending, desc.contents);
+    }
+
+    return handles;
+}
+
+BufferHandle Renderer::createEphemeralBuffer(BufferType type,
+                                             uint32_t   size,
+                                             const void *contents) {
+    assert(type != BufferType::Invalid);
+    assert(size != 0);
+    assert(contents != nullptr);
+
+    // This is on the per-frame path, so no logging and no heap allocation
+    // beyond amortized growth of the containers involved.
+    unsigned int offset = ringBufferAllocate(size, bufferAlignment(type));
+    std::memcpy(persistentMapping + offset, contents, size);
+
+    auto [buffer, bufferHandle] = buffers.add();
+    buffer.type                 = type;
+    buffer.allocationType       = BufferAllocationType::Ring;
+    buffer.buffer               = ringBuffer;
+    buffer.size                 = size;
+    buffer.offset               = offset;
+    buffer.lastUsedFrame        = currentFrame;
+
+    ephemeralBuffers.push_back(bufferHandle);
+
+    return bufferHandle;
+}
+
+void Renderer::deleteBuffer(BufferHandle handle) {
+    buffers.removeWith(std::move(handle), [this](Buffer &b) {
+        this->bufferBytes[static_cast<size_t>(b.type)] -= b.size;
+        this->retireResource(std::move(b));
+    });
+}
+
+#pragma mark - Frames
+
+void Renderer::paceFrame() {
+    using Clock = std::chrono::steady_clock;
+
+    // The frame the limit would have queued behind has to be done first.
+    unsigned int maxQueuedFrames = swapchainInfo.maxQueuedFrames;
+    if (maxQueuedFrames != 0 && maxQueuedFrames < frames.size()
+        && currentFrame > maxQueuedFrames) {
+        uint32_t frame = currentFrame - maxQueuedFrames;
+        if (frame > lastSyncedFrame) {
+            waitForFrame(frame);
+            markFrameSynced(frame);
+        }
+    }
+
+    bool first = lastFrameBegin == Clock::time_point();
+
+    if (swapchainInfo.frameRateLimit != 0 && !first) {
+        auto interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / swapchainInfo.frameRateLimit));
+        std::this_thread::sleep_until(lastFrameBegin + interval);
+    }
+
+    auto now = Clock::now();
+    if (!first) {
+        frameTimes[frameTimeCount++ % frameTimes.size()] =
+            std::chrono::duration<float, std::milli>(now - lastFrameBegin)
+                .count();
+    }
+    lastFrameBegin = now;
+}
+
+void Renderer::readGpuFrameTime(Frame &frame) {
+    if (!frame.timed) return;
+    frame.timed = false;
+
+    // The frame has completed, so its results are available.
+    std::array<uint64_t, 2> ticks = {};
+    uint32_t   query  = 2 * static_cast<uint32_t>(frame.number % frames.size());
+    vk::Result result = device.getQueryPoolResults(
+        timestampPool, query, 2, sizeof(ticks), ticks.data(),
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess) {
+        LOG_F(WARNING, "Frame %u timestamps unavailable: %s", frame.number,
+              vk::to_string(result).c_str());
+        return;
+    }
+
+    // Timestamps wrap at timestampValidBits.
+    uint64_t mask = timestampValidBits >= 64
+                        ? UINT64_MAX
+                        : (uint64_t(1) << timestampValidBits) - 1;
+    uint64_t elapsed = (ticks[1] - ticks[0]) & mask;
+
+    gpuFrameTime      = elapsed * timestampPeriod / 1000000.0f;
+    gpuFrameScale     = frame.resolutionScale;
+    gpuFrameTimeFresh = true;
+}
+
+vk::CommandBuffer Renderer::beginFrame() {
+    Frame &frame = recordingFrame();
+    assert(!frame.begun);
+
+    // What invalidates it from here on is for the next frame to show.
+    invalidated = false;
+
+    paceFrame();
+
+    // Frees what completed frames hold on to, without waiting for any.
+    pollFrames();
+
+    // An out of date swapchain is recreated and acquired from right away,
+    // so that resizing never drops a frame.
+    for (int attempt = 0; attempt < 2 && !frame.imageAcquired; ++attempt) {
+        if (isSwapchainDirty && !recreateSwapchain()) break;
+        acquireImage(frame);
+    }
+
+    // After the swapchain is recreated, which the render extent follows.
+    updateResolutionScale();
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    frame.commandBuffer.begin(beginInfo);
+    frame.begun           = true;
+    frame.resolutionScale = resolutionScale;
+
+    if (timestampPool) {
+        uint32_t query =
+            2 * static_cast<uint32_t>(currentFrame % frames.size());
+        frame.commandBuffer.resetQueryPool(timestampPool, query, 2);
+        frame.commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eTopOfPipe, timestampPool, query);
+    }
+
+    return frame.commandBuffer;
+}
+
+bool Renderer::acquireImage(Frame &frame) {
+    assert(swapchain);
+
+    // The semaphore was last waited on by this slot's previous frame, which
+    // has completed, so it is free to be signaled again.
+    vk::Result result = device.acquireNextImageKHR(
+        swapchain, UINT64_MAX, frame.acquireSemaphore, vk::Fence(),
+        &frame.imageIndex);
+
+    switch (result) {
+    case vk::Result::eSuccess: frame.imageAcquired = true; break;
+    case vk::Result::eSuboptimalKHR:
+        // Still presentable; recreate at the next frame.
+        frame.imageAcquired = true;
+        isSwapchainDirty    = true;
+        break;
+    case vk::Result::eErrorOutOfDateKHR: isSwapchainDirty = true; break;
+    default:
+        LOG_F(ERROR, "vkAcquireNextImageKHR failed: %s",
+              vk::to_string(result).c_str());
+        throw std::runtime_error("vkAcquireNextImageKHR failed");
+    }
+
+    return frame.imageAcquired;
+}
+
+void Renderer::endFrame() {
+    Frame &frame = recordingFrame();
+    assert(frame.begun);
+
+    if (timestampPool) {
+        uint32_t query =
+            2 * static_cast<uint32_t>(currentFrame % frames.size()) + 1;
+        frame.commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eBottomOfPipe, timestampPool, query);
+        frame.timed = true;
+    }
+
+    frame.commandBuffer.end();
+
+    // Submits and presents the frame, then claims the next frame's slot.
+    markFrameRecorded();
+}
+
+void Renderer::framebufferResized() {
+    isSwapchainDirty = true;
+    invalidate();
+}
+
+vk::Image Renderer::getSwapchainImage() const {
+    const Frame &frame = frames[currentFrame % frames.size()];
+    return frame.imageAcquired ? swapchainImages[frame.imageIndex]
+                               : vk::Image();
+}
+
+vk::ImageView Renderer::getSwapchainImageView() const {
+    const Frame &frame = frames[currentFrame % frames.size()];
+    return frame.imageAcquired ? swapchainImageViews[frame.imageIndex]
+                               : vk::ImageView();
+}
+
+void Renderer::setPresentPolicy(PresentMode  presentMode,
+                                unsigned int maxQueuedFrames,
+                                unsigned int frameRateLimit) {
+    swapchainInfo.maxQueuedFrames       = maxQueuedFrames;
+    swapchainInfo.frameRateLimit        = frameRateLimit;
+    wantedSwapchainInfo.maxQueuedFrames = maxQueuedFrames;
+    wantedSwapchainInfo.frameRateLimit  = frameRateLimit;
+
+    if (wantedSwapchainInfo.presentMode != presentMode) {
+        wantedSwapchainInfo.presentMode = presentMode;
+        isSwapchainDirty                = true;
+    }
+}
+
+FrameStatistics Renderer::getFrameStatistics() const {
+    FrameStatistics statistics;
+
+    switch (presentMode) {
+    case vk::PresentModeKHR::eFifoRelaxed:
+        statistics.presentMode = PresentMode::FifoRelaxed;
+        break;
+    case vk::PresentModeKHR::eMailbox:
+        statistics.presentMode = PresentMode::Mailbox;
+        break;
+    case vk::PresentModeKHR::eImmediate:
+        statistics.presentMode = PresentMode::Immediate;
+        break;
+    default: statistics.presentMode = PresentMode::Fifo; break;
+    }
+
+    statistics.gpuFrameTime    = gpuFrameTime;
+    statistics.resolutionScale = resolutionScale;
+
+    size_t count = std::min(frameTimeCount, frameTimes.size());
+    if (count == 0) return statistics;
+
+    std::vector<float> sorted(frameTimes.begin(), frameTimes.begin() + count);
+    std::sort(sorted.begin(), sorted.end());
+
+    auto percentile = [&](float p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * count));
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    };
+
+    statistics.frames = static_cast<uint32_t>(count);
+    statistics.mean =
+        std::accumulate(sorted.begin(), sorted.end(), 0.0f) / count;
+    statistics.median = percentile(0.5f);
+    statistics.p90    = percentile(0.9f);
+    statistics.p99    = percentile(0.99f);
+    statistics.max    = sorted.back();
+
+    return statistics;
+}
+
+void Renderer::invalidate() {
+    // Only the first invalidation since the last frame began need wake the
+    // event loop.
+    if (!invalidated.exchange(true) && renderOnDemand && delegate.wake) {
+        delegate.wake();
+    }
+}
+
+bool Renderer::needsFrame() {
+    if (!renderOnDemand || invalidated) return true;
+
+    // Streams only progress a frame at a time.
+    for (const auto &queue : streams) {
+        if (!queue.empty()) return true;
+    }
+
+    // Contents waiting for the copy batch or the transfer queue, and
+    // buffers retired into the frame being recorded, only go out with a
+    // frame. Worker threads invalidate() for their buffers instead.
+    if (!stagedCopies.empty() || !uploadCopies.empty() || !uploads.empty()
+        || !bufferUpdates.empty() || !recordingFrame().deletions.empty()) {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mainContext.mutex);
+        if (!mainContext.pending.empty()) return true;
+    }
+
+    // Frames finishing while idle free their deletions now rather than
+    // with the next frame.
+    pollFrames();
+
+    // Time spent idle is not frame time, nor is the next frame paced
+    // against it.
+    lastFrameBegin = std::chrono::steady_clock::time_point();
+    return false;
+}
+
+vk::CommandBuffer
+Renderer::secondaryCommandBuffer(Frame::ThreadCommands &commands) {
+    if (commands.used == commands.commandBuffers.size()) {
+        vk::CommandBufferAllocateInfo info;
+        info.commandPool        = commands.commandPool;
+        info.level              = vk::CommandBufferLevel::eSecondary;
+        info.commandBufferCount = 1;
+        commands.commandBuffers.push_back(
+            device.allocateCommandBuffers(info).at(0));
+    }
+
+    return commands.commandBuffers[commands.used++];
+}
+
+void Renderer::recordParallel(
+    uint32_t                                count,
+    const vk::CommandBufferInheritanceInfo &inheritance,
+    const RecordCallback &                  record) {
+    Frame &frame = recordingFrame();
+    assert(frame.begun);
+
+    if (count == 0) return;
+
+    uint32_t threads = recordingPool->size();
+    uint32_t chunks  = std::min(threads * chunksPerRecordingThread,
+                               (count + minimumChunkSize - 1)
+                                   / minimumChunkSize);
+    uint32_t chunkSize = (count + chunks - 1) / chunks;
+    chunks             = (count + chunkSize - 1) / chunkSize;
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    if (inheritance.renderPass) {
+        beginInfo.flags |= vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    }
+    beginInfo.pInheritanceInfo = &inheritance;
+
+    parallelCommandBuffers.resize(chunks);
+
+    // Chunks go to whichever thread is free, each into a command buffer
+    // from that thread's pool.
+    std::atomic<uint32_t> nextChunk{0};
+
+    recordingPool->run([&](unsigned int thread) {
+        Frame::ThreadCommands &commands = frame.threadCommands[thread];
+
+        for (;;) {
+            uint32_t chunk = nextChunk.fetch_add(1);
+            if (chunk >= chunks) break;
+
+            uint32_t begin = chunk * chunkSize;
+            uint32_t end   = std::min(begin + chunkSize, count);
+
+            vk::CommandBuffer commandBuffer = secondaryCommandBuffer(commands);
+            commandBuffer.begin(beginInfo);
+            record(commandBuffer, begin, end);
+            commandBuffer.end();
+
+            parallelCommandBuffers[chunk] = commandBuffer;
+        }
+    });
+
+    frame.commandBuffer.executeCommands(parallelCommandBuffers);
+}
+
+vk::CommandBuffer Renderer::copyBatch() {
+    Frame &frame = recordingFrame();
+
+    if (frame.copying) return frame.copyCommandBuffer;
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    frame.copyCommandBuffer.begin(beginInfo);
+    frame.copying = true;
+
+    return frame.copyCommandBuffer;
+}
+
+void Renderer::submitFrame() {
+    Frame &frame = recordingFrame();
+
+    // Ownership first, as staged copies may update uploaded buffers.
+    if (!uploads.empty()) { acquireUploads(copyBatch()); }
+
+    if (!stagedCopies.empty()) {
+        recordCopies(copyBatch(), stagedCopies);
+        stagedCopies.clear();
+    }
+
+    std::array<vk::SubmitInfo, 2>       submits;
+    uint32_t                            submitCount = 0;
+    std::vector<vk::Semaphore>          waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+
+    // Values for the copy batch's upload wait and the frame's signal; those
+    // for binary semaphores are ignored.
+    std::array<uint64_t, 1>      waitValues   = {};
+    std::array<vk::Semaphore, 2> signals;
+    std::array<uint64_t, 2>      signalValues = {};
+
+    if (frame.copying) {
+        // The frame's commands, and later submissions, read the copied data.
+        vk::MemoryBarrier barrier;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead
+                                | vk::AccessFlagBits::eIndexRead
+                                | vk::AccessFlagBits::eUniformRead
+                                | vk::AccessFlagBits::eTransferRead;
+        frame.copyCommandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(),
+            barrier, nullptr, nullptr);
+        frame.copyCommandBuffer.end();
+        frame.copying = false;
+
+        if (timelineSemaphores && !uploads.empty()) {
+            vk::PipelineStageFlags waitStage;
+            for (auto &op : uploads) { waitStage |= op.semaphoreWaitMask; }
+
+            waitSemaphores.push_back(uploadTimeline);
+            waitStages.push_back(waitStage);
+            waitValues[0] = uploadsSubmitted;
+        } else {
+            for (auto &op : uploads) {
+                waitSemaphores.push_back(op.semaphore);
+                waitStages.push_back(op.semaphoreWaitMask);
+            }
+        }
+
+        vk::SubmitInfo &submitInfo = submits[submitCount++];
+        submitInfo.waitSemaphoreCount =
+            static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores    = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask  = waitStages.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers    = &frame.copyCommandBuffer;
+    }
+
+    vk::PipelineStageFlags acquireStage =
+        vk::PipelineStageFlagBits::eColorAttachmentOutput;
+
+    if (frame.begun) {
+        vk::SubmitInfo &submitInfo = submits[submitCount++];
+        if (frame.imageAcquired) {
+            submitInfo.waitSemaphoreCount   = 1;
+            submitInfo.pWaitSemaphores      = &frame.acquireSemaphore;
+            submitInfo.pWaitDstStageMask    = &acquireStage;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores    = &frame.finishedSemaphore;
+        }
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers    = &frame.commandBuffer;
+        frame.begun                   = false;
+    }
+
+#ifdef VK_KHR_timeline_semaphore
+    // A semaphore signal covers everything submitted before it, so the last
+    // batch (or an empty one) signals frameTimeline for the whole frame.
+    std::array<VkTimelineSemaphoreSubmitInfoKHR, 2> timelineInfos = {};
+
+    if (timelineSemaphores) {
+        if (submitCount == 0) { submitCount = 1; }
+
+        for (uint32_t i = 0; i < submitCount; ++i) {
+            timelineInfos[i].sType =
+                VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            submits[i].pNext = &timelineInfos[i];
+        }
+
+        // Only the copy batch waits on uploadTimeline.
+        if (!waitSemaphores.empty() && waitSemaphores[0] == uploadTimeline) {
+            timelineInfos[0].waitSemaphoreValueCount = 1;
+            timelineInfos[0].pWaitSemaphoreValues    = waitValues.data();
+        }
+
+        vk::SubmitInfo &last  = submits[submitCount - 1];
+        uint32_t        count = last.signalSemaphoreCount;
+        if (count != 0) { signals[0] = last.pSignalSemaphores[0]; }
+        signals[count]      = frameTimeline;
+        signalValues[count] = currentFrame;
+
+        last.signalSemaphoreCount = count + 1;
+        last.pSignalSemaphores    = signals.data();
+        timelineInfos[submitCount - 1].signalSemaphoreValueCount = count + 1;
+        timelineInfos[submitCount - 1].pSignalSemaphoreValues =
+            signalValues.data();
+    }
+#endif
+
+    // Submitted even when empty: the fence then signals once everything
+    // submitted before it has completed, which is what the frame needs.
+    graphicsQueue.submit(vk::ArrayProxy<const vk::SubmitInfo>(
+                             submitCount, submits.data()),
+                         frame.fence);
+
+    for (auto &op : uploads) {
+        AcquiredUpload acquired;
+        acquired.frame = currentFrame;
+        acquired.op    = std::move(op);
+        acquiredUploads.emplace_back(std::move(acquired));
+    }
+    uploads.clear();
+
+    if (frame.imageAcquired) {
+        vk::PresentInfoKHR presentInfo;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores    = &frame.finishedSemaphore;
+        presentInfo.swapchainCount     = 1;
+        presentInfo.pSwapchains        = &swapchain;
+        presentInfo.pImageIndices      = &frame.imageIndex;
+
+        vk::Result result = graphicsQueue.presentKHR(&presentInfo);
+        if (result == vk::Result::eSuboptimalKHR) {
+            isSwapchainDirty = true;
+        } else if (result == vk::Result::eErrorOutOfDateKHR) {
+            // The frame was not shown.
+            isSwapchainDirty = true;
+            invalidated      = true;
+        } else if (result != vk::Result::eSuccess) {
+            LOG_F(ERROR, "vkQueuePresentKHR failed: %s",
+                  vk::to_string(result).c_str());
+            throw std::runtime_error("vkQueuePresentKHR failed");
+        }
+
+        frame.imageAcquired = false;
+    }
+}
+
+#pragma mark - Dynamic Resolution
+
+void Renderer::setInteractive(bool interactive) {
+    // The last frame shown may be at a reduced scale; show the scene at
+    // full resolution once the camera is at rest.
+    if (this->interactive && !interactive
+        && resolutionScale != maxResolutionScale) {
+        invalidated = true;
+    }
+    this->interactive = interactive;
+}
+
+vk::Extent2D Renderer::getRenderTargetExtent() const {
+    if (!swapchainTransferDestination) return swapchainExtent;
+
+    auto scaled = [&](uint32_t size) {
+        return static_cast<uint32_t>(
+            std::max(1l, std::lround(size * maxResolutionScale)));
+    };
+
+    return vk::Extent2D(scaled(swapchainExtent.width),
+                        scaled(swapchainExtent.height));
+}
+
+void Renderer::updateResolutionScale() {
+    if (!swapchainTransferDestination) {
+        // Nothing to upscale with.
+        resolutionScale   = 1.0f;
+        gpuFrameTimeFresh = false;
+        renderExtent      = swapchainExtent;
+        return;
+    }
+
+    if (!interactive || targetFrameTime <= 0.0f) {
+        resolutionScale = maxResolutionScale;
+    } else if (gpuFrameTimeFresh && gpuFrameTime > 0.0f) {
+        // GPU time goes roughly with the pixels shaded, so with the square
+        // of the scale. The measurement is a few frames old, hence relative
+        // to the scale it was made at, and the scale only goes part of the
+        // way there each frame, lest it oscillate.
+        float wanted =
+            gpuFrameScale * std::sqrt(targetFrameTime / gpuFrameTime);
+        resolutionScale += (wanted - resolutionScale) * resolutionScaleDamping;
+        resolutionScale  = std::clamp(resolutionScale, minResolutionScale,
+                                     maxResolutionScale);
+    }
+    gpuFrameTimeFresh = false;
+
+    // At the maximum scale this is the whole render target.
+    vk::Extent2D target = getRenderTargetExtent();
+    auto scaled = [&](uint32_t size, uint32_t limit) {
+        size_t aligned =
+            alignUp(static_cast<size_t>(std::lround(size * resolutionScale)),
+                    renderExtentAlignment);
+        return static_cast<uint32_t>(std::clamp<size_t>(aligned, 1, limit));
+    };
+
+    renderExtent.width  = scaled(swapchainExtent.width, target.width);
+    renderExtent.height = scaled(swapchainExtent.height, target.height);
+}
+
+void Renderer::upscale(vk::CommandBuffer commandBuffer,
+                       vk::Image         source,
+                       vk::Image         destination) const {
+    assert(swapchainTransferDestination);
+
+    vk::ImageBlit blit;
+    blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    blit.srcSubresource.layerCount = 1;
+    blit.dstSubresource            = blit.srcSubresource;
+
+    blit.srcOffsets[1] =
+        vk::Offset3D(static_cast<int32_t>(renderExtent.width),
+                     static_cast<int32_t>(renderExtent.height), 1);
+    blit.dstOffsets[1] =
+        vk::Offset3D(static_cast<int32_t>(swapchainExtent.width),
+                     static_cast<int32_t>(swapchainExtent.height), 1);
+
+    commandBuffer.blitImage(source, vk::ImageLayout::eTransferSrcOptimal,
+                            destination, vk::ImageLayout::eTransferDstOptimal,
+                            blit, vk::Filter::eLinear);
+}
+
+#pragma mark - Uploads
+
+bool Renderer::stagingRingAllocate(uint32_t size, uint32_t &offset) {
+    size_t ringSize = stagingRing.buffer.size;
+    if (ringSize == 0 || size > ringSize) return false;
+
+    size_t begin    = alignUp(stagingRing.offset, 16);
+    size_t position = begin % ringSize;
+
+    // Allocations never straddle the end of the ring; skip to the start.
+    if (position + size > ringSize) {
+        begin += ringSize - position;
+        position = 0;
+    }
+
+    size_t end = begin + size;
+
+    // The GPU may still be reading what we would overwrite.
+    if (end - stagingRing.synced > ringSize) return false;
+
+    stagingRing.offset = end;
+    offset             = static_cast<uint32_t>(position);
+
+    return true;
+}
+
+uint8_t *Renderer::stagingOverflowAllocate(uint32_t    size,
+                                           vk::Buffer &buffer,
+                                           uint32_t &  offset) {
+    if (size > stagingBlockSize) return nullptr;
+
+    for (auto &block : stagingRing.overflow) {
+        if (block.frame <= lastSyncedFrame) { block.used = 0; }
+
+        uint32_t begin = static_cast<uint32_t>(alignUp(block.used, 16));
+        if (begin + size > block.buffer.size) continue;
+
+        block.used  = begin + size;
+        block.frame = currentFrame;
+
+        buffer = block.buffer.buffer;
+        offset = begin;
+        return block.mapping + begin;
+    }
+
+    // As much overflow as there is ring, at most.
+    size_t overflowSize = stagingRing.overflow.size() * stagingBlockSize;
+    if (overflowSize + stagingBlockSize > stagingRing.buffer.size) {
+        return nullptr;
+    }
+
+    LOG_F(INFO, "Adding staging overflow block %zu",
+          stagingRing.overflow.size());
+
+    StagingRing::Overflow block;
+    block.buffer = createStagingBuffer(stagingBlockSize, &block.mapping);
+    block.used   = size;
+    block.frame  = currentFrame;
+
+    buffer = block.buffer.buffer;
+    offset = 0;
+
+    stagingRing.overflow.emplace_back(std::move(block));
+    return stagingRing.overflow.back().mapping;
+}
+
+UploadOp Renderer::allocateUploadOp() {
+    UploadOp op;
+
+    if (!freeUploadOps.empty()) {
+        op = std::move(freeUploadOps.back());
+        freeUploadOps.pop_back();
+    } else {
+        vk::CommandBufferAllocateInfo info;
+        info.commandPool        = transferCommandPool;
+        info.level              = vk::CommandBufferLevel::ePrimary;
+        info.commandBufferCount = 1;
+        op.commandBuffer        = device.allocateCommandBuffers(info).at(0);
+
+        // With timeline semaphores, every op signals uploadTimeline instead.
+        if (!timelineSemaphores) {
+            op.semaphore = device.createSemaphore(vk::SemaphoreCreateInfo(),
+                                                  allocationCallbacks);
+        }
+    }
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    op.commandBuffer.begin(beginInfo);
+
+    // Only the acquire barriers (and copies) in the batch wait.
+    op.semaphoreWaitMask = vk::PipelineStageFlagBits::eTransfer;
+
+    return op;
+}
+
+void Renderer::submitUploadOp(UploadOp &&op) {
+    assert(op.commandBuffer);
+
+    // Without a dedicated transfer family there is no ownership to pass on;
+    // the semaphore alone makes the writes visible.
+    if (transferQueueIndex == graphicsQueueIndex) {
+        op.bufferAcquireBarriers.clear();
+        op.imageAcquireBarriers.clear();
+    }
+
+    std::vector<vk::BufferMemoryBarrier> bufferReleaseBarriers;
+    for (auto &acquire : op.bufferAcquireBarriers) {
+        acquire.srcQueueFamilyIndex = transferQueueIndex;
+        acquire.dstQueueFamilyIndex = graphicsQueueIndex;
+
+        vk::BufferMemoryBarrier release = acquire;
+        release.srcAccessMask           = vk::AccessFlagBits::eTransferWrite;
+        release.dstAccessMask           = vk::AccessFlags();
+        bufferReleaseBarriers.push_back(release);
+
+        acquire.srcAccessMask = vk::AccessFlags();
+    }
+
+    std::vector<vk::ImageMemoryBarrier> imageReleaseBarriers;
+    for (auto &acquire : op.imageAcquireBarriers) {
+        acquire.srcQueueFamilyIndex = transferQueueIndex;
+        acquire.dstQueueFamilyIndex = graphicsQueueIndex;
+
+        // Layouts must match on both sides.
+        vk::ImageMemoryBarrier release = acquire;
+        release.srcAccessMask          = vk::AccessFlagBits::eTransferWrite;
+        release.dstAccessMask          = vk::AccessFlags();
+        imageReleaseBarriers.push_back(release);
+
+        acquire.srcAccessMask = vk::AccessFlags();
+    }
+
+    if (!bufferReleaseBarriers.empty() || !imageReleaseBarriers.empty()) {
+        op.commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(),
+            nullptr, bufferReleaseBarriers, imageReleaseBarriers);
+    }
+
+    op.commandBuffer.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &op.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &op.semaphore;
+
+#ifdef VK_KHR_timeline_semaphore
+    // The transfer queue executes in order, so the copy batch need only wait
+    // for the value of the last op submitted.
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+    uint64_t                         signalValue  = ++uploadsSubmitted;
+
+    if (timelineSemaphores) {
+        timelineInfo.sType =
+            VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues    = &signalValue;
+
+        submitInfo.pSignalSemaphores = &uploadTimeline;
+        submitInfo.pNext             = &timelineInfo;
+    }
+#endif
+
+    transferQueue.submit(submitInfo, vk::Fence());
+
+    uploads.emplace_back(std::move(op));
+}
+
+void Renderer::acquireUploads(vk::CommandBuffer commandBuffer) {
+    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier>  imageBarriers;
+
+    for (auto &op : uploads) {
+        bufferBarriers.insert(bufferBarriers.end(),
+                              op.bufferAcquireBarriers.begin(),
+                              op.bufferAcquireBarriers.end());
+        imageBarriers.insert(imageBarriers.end(),
+                             op.imageAcquireBarriers.begin(),
+                             op.imageAcquireBarriers.end());
+    }
+
+    if (bufferBarriers.empty() && imageBarriers.empty()) return;
+
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eAllCommands,
+                                  vk::DependencyFlags(), nullptr,
+                                  bufferBarriers, imageBarriers);
+}
+
+void Renderer::recycleUploadOp(UploadOp &op) {
+    // The semaphore has been waited on, so it is unsignaled again.
+    op.commandBuffer.reset(vk::CommandBufferResetFlags());
+    op.semaphoreWaitMask = vk::PipelineStageFlags();
+
+    op.bufferAcquireBarriers.clear();
+    op.imageAcquireBarriers.clear();
+}
+
+void Renderer::freeUploadOp(UploadOp &op) {
+    recycleUploadOp(op);
+
+    device.freeCommandBuffers(transferCommandPool, op.commandBuffer);
+    op.commandBuffer = vk::CommandBuffer();
+
+    device.destroySemaphore(op.semaphore, allocationCallbacks);
+    op.semaphore = vk::Semaphore();
+}
+
+bool Renderer::uploadAsync(Buffer &b, const void *contents) {
+    if (asyncUploadThreshold == 0 || b.size < asyncUploadThreshold) {
+        return false;
+    }
+
+    // Pool blocks are shared with buffers the graphics queue is using, so
+    // their ownership stays put.
+    if (b.allocationType != BufferAllocationType::Default) return false;
+
+    stageUpload(b, 0, contents, b.size);
+
+    return true;
+}
+
+void Renderer::stageUpload(Buffer &     b,
+                           uint32_t     offset,
+                           const void * contents,
+                           uint32_t     size) {
+    assert(b.allocationType == BufferAllocationType::Default);
+    assert(offset + size <= b.size);
+
+    UploadCopy copy;
+    copy.destination = b.buffer;
+    copy.access      = bufferTypeAccessFlags(b.type);
+
+    uint32_t stagingOffset = 0;
+    uint8_t *mapping       = nullptr;
+
+    if (stagingRingAllocate(size, stagingOffset)) {
+        mapping     = stagingRing.mapping + stagingOffset;
+        copy.source = stagingRing.buffer.buffer;
+    } else {
+        mapping = stagingOverflowAllocate(size, copy.source, stagingOffset);
+    }
+
+    if (!mapping) {
+        Buffer staging = createStagingBuffer(size, &mapping);
+        copy.source    = staging.buffer;
+
+        // Freed with the frame, by which time the upload has completed.
+        staging.lastUsedFrame = currentFrame;
+        retireResource(std::move(staging));
+    }
+
+    std::memcpy(mapping, contents, size);
+
+    copy.region = vk::BufferCopy(stagingOffset, b.offset + offset, size);
+    uploadCopies.push_back(copy);
+}
+
+void Renderer::recordCopies(vk::CommandBuffer        commandBuffer,
+                            std::vector<UploadCopy> &copies) {
+    // Moved by defragmentation, or deleted, since the copy was made.
+    for (auto &copy : copies) {
+        if (!copy.handle || !buffers.contains(copy.handle)) continue;
+
+        const Buffer &b = buffers.get(copy.handle);
+        copy.destination = b.buffer;
+        copy.region.dstOffset += b.offset;
+        copy.handle = BufferHandle();
+    }
+    copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                [](const UploadCopy &copy) {
+                                    return static_cast<bool>(copy.handle);
+                                }),
+                 copies.end());
+
+    // Stable, so that copies to the same place land in the order made.
+    std::stable_sort(copies.begin(), copies.end(),
+                     [](const UploadCopy &a, const UploadCopy &b) {
+                         return a.destination < b.destination;
+                     });
+
+    for (size_t i = 0; i < copies.size();) {
+        copyRegions.clear();
+
+        const UploadCopy &first = copies[i];
+
+        // The same destination from another source, e.g. an update to a
+        // buffer created in the same frame. The ranges may overlap, and the
+        // later copy has to win.
+        if (i != 0 && copies[i - 1].destination == first.destination) {
+            vk::MemoryBarrier barrier;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            commandBuffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(),
+                barrier, nullptr, nullptr);
+        }
+
+        size_t j = i;
+        for (; j < copies.size(); ++j) {
+            if (copies[j].destination != first.destination
+                || copies[j].source != first.source) {
+                break;
+            }
+            copyRegions.push_back(copies[j].region);
+        }
+
+        commandBuffer.copyBuffer(first.source, first.destination,
+                                 copyRegions);
+        i = j;
+    }
+}
+
+void Renderer::submitUploads() {
+    if (uploadCopies.empty()) return;
+
+    // All of the frame's uploads go out in one submission.
+    UploadOp op = allocateUploadOp();
+
+    recordCopies(op.commandBuffer, uploadCopies);
+
+    for (auto &copy : uploadCopies) {
+        vk::BufferMemoryBarrier acquire;
+        acquire.dstAccessMask = copy.access;
+        acquire.buffer        = copy.destination;
+        acquire.offset        = copy.region.dstOffset;
+        acquire.size          = copy.region.size;
+        op.bufferAcquireBarriers.push_back(acquire);
+    }
+    uploadCopies.clear();
+
+    submitUploadOp(std::move(op));
+}
+
+#pragma mark - Updates
+
+void Renderer::updateBuffer(BufferHandle handle,
+                            uint32_t     offset,
+                            uint32_t     size,
+                            const void * data) {
+    assert(size != 0);
+    assert(data != nullptr);
+
+    Buffer &b = buffers.get(handle);
+    assert(b.allocationType != BufferAllocationType::Ring);
+    assert(offset + size <= b.size);
+    (void)b;
+
+    // Byte aligned, so that consecutive updates stay contiguous in the ring
+    // and merge into one region.
+    unsigned int sourceOffset = ringBufferAllocate(size, 1);
+    std::memcpy(persistentMapping + sourceOffset, data, size);
+
+    BufferUpdate update;
+    update.handle       = handle;
+    update.source       = ringBuffer;
+    update.sourceOffset = sourceOffset;
+    update.offset       = offset;
+    update.size         = size;
+    bufferUpdates.push_back(update);
+}
+
+void Renderer::flushBufferUpdates() {
+    if (bufferUpdates.empty()) return;
+
+    // Unlike newly created buffers, these are live: frames still in flight
+    // may be reading what the copies overwrite. The copies are recorded
+    // after this, and every earlier frame was submitted before it.
+    vk::PipelineStageFlags readers =
+        vk::PipelineStageFlagBits::eVertexInput
+        | vk::PipelineStageFlagBits::eVertexShader
+        | vk::PipelineStageFlagBits::eFragmentShader;
+    copyBatch().pipelineBarrier(readers, vk::PipelineStageFlagBits::eTransfer,
+                                vk::DependencyFlags(), nullptr, nullptr,
+                                nullptr);
+
+    // Resolved now, as pooled buffers may have been moved during the frame.
+    for (auto &update : bufferUpdates) {
+        if (!buffers.contains(update.handle)) continue;
+
+        Buffer &b       = buffers.get(update.handle);
+        b.lastUsedFrame = currentFrame;
+
+        UploadCopy copy;
+        copy.source      = update.source;
+        copy.destination = b.buffer;
+        copy.region      = vk::BufferCopy(update.sourceOffset,
+                                     b.offset + update.offset, update.size);
+        updateCopies.push_back(copy);
+    }
+    bufferUpdates.clear();
+
+    // Buffers in the same pool block are merged together, which is fine as
+    // their ranges never overlap.
+    std::stable_sort(updateCopies.begin(), updateCopies.end(),
+                     [](const UploadCopy &a, const UploadCopy &b) {
+                         return a.destination < b.destination;
+                     });
+
+    for (size_t i = 0; i < updateCopies.size();) {
+        size_t j = i;
+        while (j < updateCopies.size()
+               && updateCopies[j].destination == updateCopies[i].destination) {
+            j++;
+        }
+
+        mergeBufferUpdates(updateCopies.data() + i, updateCopies.data() + j);
+        i = j;
+    }
+    updateCopies.clear();
+}
+
+void Renderer::mergeBufferUpdates(const UploadCopy *begin,
+                                  const UploadCopy *end) {
+    // Newest first, each update contributes whatever newer ones left
+    // uncovered. updatedRanges holds the covered [begin, end) ranges,
+    // disjoint and not touching.
+    updatedRanges.clear();
+    size_t first = stagedCopies.size();
+
+    auto emit = [&](const UploadCopy &update, uint32_t from, uint32_t to) {
+        auto skipped = from - static_cast<uint32_t>(update.region.dstOffset);
+
+        UploadCopy copy  = update;
+        copy.region      = vk::BufferCopy(update.region.srcOffset + skipped,
+                                     from, to - from);
+        stagedCopies.push_back(copy);
+    };
+
+    for (const UploadCopy *update = end; update-- != begin;) {
+        auto from = static_cast<uint32_t>(update->region.dstOffset);
+        auto to   = static_cast<uint32_t>(from + update->region.size);
+
+        auto it = updatedRanges.upper_bound(from);
+        if (it != updatedRanges.begin() && std::prev(it)->second > from) {
+            --it;
+        }
+
+        for (uint32_t cursor = from; cursor < to;) {
+            if (it == updatedRanges.end() || it->first >= to) {
+                emit(*update, cursor, to);
+                break;
+            }
+            if (it->first > cursor) { emit(*update, cursor, it->first); }
+            cursor = std::max(cursor, it->second);
+            ++it;
+        }
+
+        // Add [from, to), absorbing what it overlaps or touches.
+        auto low = updatedRanges.lower_bound(from);
+        if (low != updatedRanges.begin() && std::prev(low)->second >= from) {
+            --low;
+        }
+
+        auto high = low;
+        for (; high != updatedRanges.end() && high->first <= to; ++high) {
+            from = std::min(from, high->first);
+            to   = std::max(to, high->second);
+        }
+
+        updatedRanges.erase(low, high);
+        updatedRanges.emplace(from, to);
+    }
+
+    // What is left never overlaps, so order no longer matters. Coalesce
+    // ranges adjacent in both source and destination.
+    std::sort(stagedCopies.begin() + first, stagedCopies.end(),
+              [](const UploadCopy &a, const UploadCopy &b) {
+                  return a.region.dstOffset < b.region.dstOffset;
+              });
+
+    size_t last = first;
+    for (size_t i = first + 1; i < stagedCopies.size(); ++i) {
+        UploadCopy &      previous = stagedCopies[last];
+        const UploadCopy &current  = stagedCopies[i];
+
+        if (previous.source == current.source
+            && previous.region.srcOffset + previous.region.size
+                   == current.region.srcOffset
+            && previous.region.dstOffset + previous.region.size
+                   == current.region.dstOffset) {
+            previous.region.size += current.region.size;
+        } else {
+            stagedCopies[++last] = current;
+        }
+    }
+
+    if (first < stagedCopies.size()) { stagedCopies.resize(last + 1); }
+}
+
+#pragma mark - Quantized Vertices
+
+BufferHandle
+Renderer::createQuantizedVertexBuffer(const float *             positions,
+                                      const float *             normals,
+                                      uint32_t                  count,
+                                      const QuantizationBounds &bounds) {
+    assert(count != 0);
+
+    quantizedScratch.resize(count);
+    quantizeVertices(positions, normals, count, bounds,
+                     quantizedScratch.data());
+
+    return createBuffer(BufferType::Vertex,
+                        count * sizeof(QuantizedVertex),
+                        quantizedScratch.data());
+}
+
+void Renderer::updateQuantizedVertexBuffer(BufferHandle              handle,
+                                           uint32_t                  first,
+                                           const float *             positions,
+                                           const float *             normals,
+                                           uint32_t                  count,
+                                           const QuantizationBounds &bounds) {
+    assert(count != 0);
+
+    quantizedScratch.resize(count);
+    quantizeVertices(positions, normals, count, bounds,
+                     quantizedScratch.data());
+
+    updateBuffer(handle, first * sizeof(QuantizedVertex),
+                 count * sizeof(QuantizedVertex), quantizedScratch.data());
+}
+
+#pragma mark - Streaming
+
+BufferHandle Renderer::streamBuffer(BufferType             type,
+                                    uint32_t               size,
+                                    const void *           contents,
+                                    UploadPriority         priority,
+                                    UploadProgressCallback onProgress) {
+    LOG_SCOPE_F(INFO, "Streaming a %s buffer of size %u",
+                bufferTypeString(type).c_str(), size);
+
+    assert(type != BufferType::Invalid);
+    assert(size != 0);
+    assert(contents != nullptr);
+
+    auto [buffer, bufferHandle] = buffers.add();
+
+    buffer.size          = size;
+    buffer.type          = type;
+    buffer.lastUsedFrame = currentFrame;
+
+    bufferBytes[static_cast<size_t>(type)] += size;
+
+    // Never pooled; uploads go to the transfer queue, which only dedicated
+    // buffers may.
+    Stream stream;
+    stream.handle     = bufferHandle;
+    stream.contents   = reinterpret_cast<const uint8_t *>(contents);
+    stream.mapping    = allocateDedicatedBuffer(buffer, type, size);
+    stream.size       = size;
+    stream.onProgress = std::move(onProgress);
+
+    streams[static_cast<size_t>(priority)].emplace_back(std::move(stream));
+
+    return bufferHandle;
+}
+
+void Renderer::setUploadPriority(BufferHandle handle, UploadPriority priority) {
+    auto &target = streams[static_cast<size_t>(priority)];
+
+    for (auto &queue : streams) {
+        auto it = std::find_if(
+            queue.begin(), queue.end(),
+            [&](const Stream &stream) { return stream.handle == handle; });
+
+        if (it == queue.end()) continue;
+        if (&queue == &target) return;
+
+        target.emplace_back(std::move(*it));
+        queue.erase(it);
+        return;
+    }
+}
+
+void Renderer::streamUploads() {
+    size_t budget = uploadBytesPerFrame;
+
+    for (auto &queue : streams) {
+        while (budget != 0 && !queue.empty()) {
+            Stream &stream = queue.front();
+
+            // Deleted (or evicted) part way.
+            if (!buffers.contains(stream.handle)) {
+                queue.pop_front();
+                continue;
+            }
+
+            uint32_t chunk = static_cast<uint32_t>(
+                std::min<size_t>(budget, stream.size - stream.uploaded));
+            const uint8_t *source = stream.contents + stream.uploaded;
+
+            if (stream.mapping) {
+                std::memcpy(stream.mapping + stream.uploaded, source, chunk);
+            } else {
+                stageUpload(buffers.get(stream.handle), stream.uploaded,
+                            source, chunk);
+            }
+
+            stream.uploaded += chunk;
+            budget -= chunk;
+
+            bool done = stream.uploaded == stream.size;
+
+            // Callbacks may stream more buffers or reprioritize, so they are
+            // called once the queues are left alone.
+            if (stream.onProgress) {
+                StreamProgress progress;
+                progress.handle     = stream.handle;
+                progress.uploaded   = stream.uploaded;
+                progress.total      = stream.size;
+                progress.onProgress = done ? std::move(stream.onProgress)
+                                           : stream.onProgress;
+                streamProgress.emplace_back(std::move(progress));
+            }
+
+            if (done) { queue.pop_front(); }
+        }
+    }
+
+    // What went out is only usable from the next frame on.
+    if (budget != uploadBytesPerFrame) { invalidated = true; }
+
+    for (auto &progress : streamProgress) {
+        progress.onProgress(progress.handle, progress.uploaded,
+                            progress.total);
+    }
+    streamProgress.clear();
+}
+
+#pragma mark - Files
+
+bool Renderer::importHostMemory(void *            mapping,
+                                size_t            length,
+                                vk::Buffer &      buffer,
+                                vk::DeviceMemory &memory) {
+#ifdef VK_EXT_external_memory_host
+    if (!hostMemoryImport) return false;
+
+    // The import covers whole units of the alignment, which must not reach
+    // past the pages actually mapped.
+    size_t pageSize   = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t importSize = alignUp(length, hostPointerAlignment);
+
+    if (reinterpret_cast<uintptr_t>(mapping) % hostPointerAlignment != 0
+        || importSize > alignUp(length, pageSize)) {
+        return false;
+    }
+
+    auto handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+    pointerProperties.sType =
+        VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+
+    // Not every driver accepts file backed memory.
+    if (pfn_vkGetMemoryHostPointerPropertiesEXT(device, handleType, mapping,
+                                                &pointerProperties)
+        != VK_SUCCESS) {
+        return false;
+    }
+
+    VkExternalMemoryBufferCreateInfoKHR externalInfo = {};
+    externalInfo.sType =
+        VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR;
+    externalInfo.handleTypes = handleType;
+
+    vk::BufferCreateInfo info;
+    info.pNext = &externalInfo;
+    info.size  = importSize;
+    info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    buffer     = device.createBuffer(info, allocationCallbacks);
+
+    auto     requirements = device.getBufferMemoryRequirements(buffer);
+    uint32_t memoryTypes =
+        requirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+
+    if (memoryTypes == 0 || requirements.size > importSize) {
+        device.destroyBuffer(buffer, allocationCallbacks);
+        buffer = vk::Buffer();
+        return false;
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType   = handleType;
+    importInfo.pHostPointer = mapping;
+
+    vk::MemoryAllocateInfo allocateInfo;
+    allocateInfo.pNext           = &importInfo;
+    allocateInfo.allocationSize  = importSize;
+    allocateInfo.memoryTypeIndex = __builtin_ctz(memoryTypes);
+
+    auto result =
+        device.allocateMemory(&allocateInfo, allocationCallbacks, &memory);
+
+    if (result != vk::Result::eSuccess) {
+        LOG_F(WARNING, "Host memory import failed: %s",
+              vk::to_string(result).c_str());
+        device.destroyBuffer(buffer, allocationCallbacks);
+        buffer = vk::Buffer();
+        return false;
+    }
+
+    device.bindBufferMemory(buffer, memory, 0);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+BufferHandle Renderer::createBufferFromFile(BufferType         type,
+                                            const std::string &path,
+                                            size_t             offset,
+                                            size_t             size) {
+    LOG_SCOPE_F(INFO, "Creating a %s buffer from %s",
+                bufferTypeString(type).c_str(), path.c_str());
+
+    assert(type != BufferType::Invalid);
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_F(ERROR, "Could not open %s: %s", path.c_str(), strerror(errno));
+        throw std::runtime_error("Could not open file");
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        LOG_F(ERROR, "Could not stat %s: %s", path.c_str(), strerror(errno));
+        close(fd);
+        throw std::runtime_error("Could not stat file");
+    }
+
+    size_t fileSize = static_cast<size_t>(status.st_size);
+    if (size == 0 && offset < fileSize) { size = fileSize - offset; }
+
+    if (size == 0 || offset + size > fileSize || size > UINT32_MAX) {
+        LOG_F(ERROR, "Bad range %zu+%zu of %s (%zu bytes)", offset, size,
+              path.c_str(), fileSize);
+        close(fd);
+        throw std::runtime_error("Bad file range");
+    }
+
+    // Mappings start on a page boundary, and imports on an import
+    // alignment boundary, which is in practice the page size too.
+    size_t pageSize =
+        std::max(static_cast<size_t>(sysconf(_SC_PAGESIZE)),
+                 static_cast<size_t>(hostPointerAlignment));
+    size_t mapOffset = offset - offset % pageSize;
+    size_t mapLength = offset + size - mapOffset;
+
+    void *mapping = mmap(nullptr, mapLength, PROT_READ, MAP_PRIVATE, fd,
+                         static_cast<off_t>(mapOffset));
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        LOG_F(ERROR, "Could not map %s: %s", path.c_str(), strerror(errno));
+        throw std::runtime_error("Could not map file");
+    }
+
+    // Read front to back exactly once, whoever ends up reading it.
+    madvise(mapping, mapLength, MADV_SEQUENTIAL);
+
+    const uint8_t *contents =
+        reinterpret_cast<const uint8_t *>(mapping) + (offset - mapOffset);
+
+    auto [buffer, bufferHandle] = buffers.add();
+
+    buffer.size          = static_cast<uint32_t>(size);
+    buffer.type          = type;
+    buffer.lastUsedFrame = currentFrame;
+
+    bufferBytes[static_cast<size_t>(type)] += size;
+
+    uint8_t *bufferMapping =
+        isPooled(type, buffer.size)
+            ? allocatePooledBuffer(buffer, type, buffer.size)
+            : allocateDedicatedBuffer(buffer, type, buffer.size);
+
+    ImportedFile file;
+
+    if (bufferMapping) {
+        std::memcpy(bufferMapping, contents, size);
+    } else if (importHostMemory(mapping, mapLength, file.buffer,
+                                file.memory)) {
+        LOG_F(INFO, "Staging directly from the file mapping");
+
+        UploadCopy copy;
+        copy.source = file.buffer;
+        copy.handle = bufferHandle;
+        copy.access = bufferTypeAccessFlags(type);
+        copy.region = vk::BufferCopy(offset - mapOffset, 0, buffer.size);
+
+        // Only dedicated buffers may go through the transfer queue.
+        if (buffer.allocationType == BufferAllocationType::Default) {
+            uploadCopies.push_back(copy);
+        } else {
+            stagedCopies.push_back(copy);
+        }
+
+        file.frame   = currentFrame;
+        file.mapping = mapping;
+        file.length  = mapLength;
+        importedFiles.emplace_back(std::move(file));
+
+        return bufferHandle;
+    } else if (!uploadAsync(buffer, contents)) {
+        WorkerContext::Pending pending;
+        pending.handle = bufferHandle;
+        pending.type   = type;
+        pending.size   = buffer.size;
+
+        std::lock_guard<std::mutex> lock(mainContext.mutex);
+        stage(mainContext, pending, contents);
+    }
+
+    // The contents have been copied out by now.
+    munmap(mapping, mapLength);
+
+    return bufferHandle;
+}
+
+#pragma mark - Defragmentation
+
+void Renderer::chooseEvacuationBlock(BufferPool &pool) {
+    if (pool.evacuating || pool.blocks.size() < 2) return;
+
+    auto sparsest = std::min_element(
+        pool.blocks.begin(), pool.blocks.end(),
+        [](const BufferPool::Block &a, const BufferPool::Block &b) {
+            return a.allocator.getUsed() < b.allocator.getUsed();
+        });
+
+    // Only worth it while the block is mostly empty, and only possible if
+    // everything in it fits elsewhere (modulo fragmentation there).
+    if (sparsest->allocator.getUsed() > sparsest->allocator.getSize() / 2)
+        return;
+
+    size_t available = 0;
+    for (const auto &block : pool.blocks) {
+        if (block.buffer == sparsest->buffer) continue;
+        available += block.allocator.getSize() - block.allocator.getUsed();
+    }
+
+    if (available < sparsest->allocator.getUsed()) return;
+
+    LOG_F(INFO, "Evacuating a buffer pool block holding %u bytes",
+          sparsest->allocator.getUsed());
+    pool.evacuating = sparsest->buffer;
+}
+
+void Renderer::chooseEvacuationMemory() {
+    // Nothing can have become sparse unless something was freed.
+    if (evacuatingMemory != VK_NULL_HANDLE || !dedicatedFreed) return;
+    dedicatedFreed = false;
+
+    struct BlockUse {
+        uint32_t     memoryType = 0;
+        VkDeviceSize used       = 0;
+    };
+
+    std::unordered_map<VkDeviceMemory, BlockUse> blocks;
+
+    for (const auto &b : buffers) {
+        if (b.allocationType != BufferAllocationType::Default) continue;
+
+        VmaAllocationInfo allocationInfo = {};
+        vmaGetAllocationInfo(allocator, b.memory, &allocationInfo);
+
+        BlockUse &use  = blocks[allocationInfo.deviceMemory];
+        use.memoryType = allocationInfo.memoryType;
+        use.used += allocationInfo.size;
+    }
+
+    if (blocks.size() < 2) return;
+
+    auto sparsest = std::min_element(
+        blocks.begin(), blocks.end(), [](const auto &a, const auto &b) {
+            return a.second.used < b.second.used;
+        });
+
+    // VMA does not report per block, so this goes by the average block of
+    // the memory type. Only our buffers are counted; a block that also
+    // holds pool blocks or staging stays, but with fewer holes in it.
+    VmaStats stats = {};
+    vmaCalculateStats(allocator, &stats);
+
+    const VmaStatInfo &type = stats.memoryType[sparsest->second.memoryType];
+    if (type.blockCount < 2) return;
+
+    VkDeviceSize blockSize =
+        (type.usedBytes + type.unusedBytes) / type.blockCount;
+    VkDeviceSize used = sparsest->second.used;
+
+    // Mostly empty, and the rest of the type's free space, which is
+    // unusedBytes less the blockSize - used free in this block, fits it.
+    if (used > blockSize / 2 || type.unusedBytes < blockSize) return;
+
+    LOG_F(INFO, "Evacuating a VMA block holding %u bytes of buffers",
+          static_cast<unsigned int>(used));
+    evacuatingMemory = sparsest->first;
+}
+
+void Renderer::defragmentStep() {
+    if (defragmentationMicroseconds == 0) return;
+
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::microseconds(defragmentationMicroseconds);
+
+    vk::CommandBuffer commandBuffer;
+    size_t            moved = 0;
+
+    for (BufferPool *pool : {&vertexPool, &indexPool}) {
+        // The evacuation lasts until the block's last ranges come out of
+        // the graveyard and freePooledBuffer releases it, so that nothing
+        // is allocated from it in the meantime.
+        chooseEvacuationBlock(*pool);
+        if (!pool->evacuating) continue;
+
+        for (auto &b : buffers) {
+            if (b.allocationType != BufferAllocationType::Pooled
+                || b.buffer != pool->evacuating)
+                continue;
+
+            if (moved >= defragmentationBytesPerFrame
+                || std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+
+            unsigned int alignment = bufferAlignment(b.type);
+            uint32_t     offset    = 0;
+
+            auto dst = pool->blocks.begin();
+            for (; dst != pool->blocks.end(); ++dst) {
+                if (dst->buffer == pool->evacuating) continue;
+                if (dst->allocator.allocate(b.size, alignment, offset)) break;
+            }
+
+            if (dst == pool->blocks.end()) {
+                // The other blocks are too fragmented after all; give up on
+                // this block and let a sparser one be picked later.
+                LOG_F(WARNING, "Buffer pool evacuation ran out of room");
+                pool->evacuating = vk::Buffer();
+                break;
+            }
+
+            if (!commandBuffer) { commandBuffer = copyBatch(); }
+
+            commandBuffer.copyBuffer(b.buffer, dst->buffer,
+                                     vk::BufferCopy(b.offset, offset, b.size));
+
+            // The old range is read by the copy, and possibly by frames
+            // still in flight, so it goes through the graveyard.
+            Buffer old;
+            old.type           = b.type;
+            old.allocationType = BufferAllocationType::Pooled;
+            old.buffer         = b.buffer;
+            old.offset         = b.offset;
+            old.size           = b.size;
+            old.lastUsedFrame  = currentFrame;
+            retireResource(std::move(old));
+
+            // Patch the entry in place; handles stay valid.
+            b.buffer        = dst->buffer;
+            b.offset        = offset;
+            b.lastUsedFrame = currentFrame;
+
+            moved += b.size;
+        }
+    }
+
+    // Transfer queue uploads and streams write to the vk::Buffer or the
+    // mapping they started with, so buffers with their own allocation
+    // stay put until those are done.
+    bool uploading = !uploads.empty() || !uploadCopies.empty();
+    for (const auto &queue : streams) { uploading |= !queue.empty(); }
+
+    chooseEvacuationMemory();
+
+    if (evacuatingMemory != VK_NULL_HANDLE && !uploading) {
+        bool remaining = false;
+
+        for (auto &b : buffers) {
+            if (b.allocationType != BufferAllocationType::Default) continue;
+
+            VmaAllocationInfo allocationInfo = {};
+            vmaGetAllocationInfo(allocator, b.memory, &allocationInfo);
+            if (allocationInfo.deviceMemory != evacuatingMemory) continue;
+
+            remaining = true;
+
+            if (moved >= defragmentationBytesPerFrame
+                || std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+
+            // VMA prefers its fullest blocks, so the new allocation lands
+            // outside the sparse one unless there is no room elsewhere.
+            Buffer replacement;
+            replacement.type = b.type;
+            try {
+                allocateDedicatedBuffer(replacement, b.type, b.size);
+            } catch (const std::runtime_error &) {
+                evacuatingMemory = VK_NULL_HANDLE;
+                break;
+            }
+
+            vmaGetAllocationInfo(allocator, replacement.memory,
+                                 &allocationInfo);
+            if (allocationInfo.deviceMemory == evacuatingMemory) {
+                LOG_F(WARNING, "VMA block evacuation ran out of room");
+                deleteBufferInternal(replacement);
+                dedicatedFreed   = false;
+                evacuatingMemory = VK_NULL_HANDLE;
+                break;
+            }
+
+            if (!commandBuffer) { commandBuffer = copyBatch(); }
+
+            commandBuffer.copyBuffer(b.buffer, replacement.buffer,
+                                     vk::BufferCopy(0, 0, b.size));
+
+            Buffer old;
+            old.type           = b.type;
+            old.allocationType = BufferAllocationType::Default;
+            old.buffer         = b.buffer;
+            old.memory         = b.memory;
+            old.size           = b.size;
+            old.lastUsedFrame  = currentFrame;
+            retireResource(std::move(old));
+
+            b.buffer        = replacement.buffer;
+            b.memory        = replacement.memory;
+            b.lastUsedFrame = currentFrame;
+
+            replacement.buffer = vk::Buffer();
+            replacement.memory = nullptr;
+            replacement.type   = BufferType::Invalid;
+
+            moved += b.size;
+        }
+
+        if (!remaining) { evacuatingMemory = VK_NULL_HANDLE; }
+    }
+
+    if (moved == 0) return;
+
+    // Staged copies recorded after this may target the ranges just moved
+    // into, or read from.
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask =
+        vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eTransfer,
+                                  vk::DependencyFlags(), barrier, nullptr,
+                                  nullptr);
+
+    LOG_F(INFO, "Defragmentation moved %zu bytes", moved);
+}
+
+#pragma mark - Worker Threads
+
+WorkerContext &Renderer::createWorkerContext() {
+    std::lock_guard<std::mutex> lock(workerContextsMutex);
+
+    workerContexts.emplace_back(new WorkerContext());
+    return *workerContexts.back();
+}
+
+BufferHandle Renderer::createBuffer(WorkerContext &context,
+                                    BufferType     type,
+                                    uint32_t       size,
+                                    const void *   contents) {
+    assert(type != BufferType::Invalid);
+    assert(size != 0);
+    assert(contents != nullptr);
+
+    WorkerContext::Pending pending;
+    pending.handle   = buffers.reserve();
+    pending.type     = type;
+    pending.size     = size;
+    pending.reserved = true;
+
+    // VMA is created without VMA_ALLOCATOR_CREATE_EXTERNALLY_SYNCHRONIZED_BIT
+    // and so locks internally, and creating Vulkan objects needs no external
+    // synchronization. The pools are ours and not thread-safe, so pooled
+    // buffers are sub-allocated when the renderer commits them instead.
+    uint8_t *mapping = nullptr;
+
+    if (!isPooled(type, size)) {
+        mapping = allocateDedicatedBuffer(pending.buffer, type, size);
+        pending.buffer.type = type;
+        pending.buffer.size = size;
+    }
+
+    BufferHandle handle = pending.handle;
+
+    if (mapping) {
+        std::memcpy(mapping, contents, size);
+
+        // Still has to be committed, but there is nothing to copy.
+        std::lock_guard<std::mutex> lock(context.mutex);
+        context.pending.emplace_back(std::move(pending));
+    } else {
+        std::lock_guard<std::mutex> lock(context.mutex);
+        stage(context, pending, contents);
+    }
+
+    // Committed by the next frame, which an idle loop rendering on demand
+    // has to be woken for.
+    invalidate();
+
+    return handle;
+}
+
+Buffer Renderer::createStagingBuffer(uint32_t size, uint8_t **mapping) {
+    vk::BufferCreateInfo info;
+    info.size  = size;
+    info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+
+    Buffer staging;
+    staging.buffer = device.createBuffer(info, allocationCallbacks);
+
+    VmaAllocationCreateInfo requestInfo = {};
+    requestInfo.flags                   = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    requestInfo.usage                   = VMA_MEMORY_USAGE_CPU_ONLY;
+    requestInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VmaAllocationInfo allocationInfo = {};
+
+    auto result =
+        vmaAllocateMemoryForBuffer(allocator, staging.buffer, &requestInfo,
+                                   &staging.memory, &allocationInfo);
+
+    if (result != VK_SUCCESS) {
+        device.destroyBuffer(staging.buffer, allocationCallbacks);
+        staging.buffer = vk::Buffer();
+        LOG_F(ERROR, "vmaAllocateMemoryForBuffer failed: %s",
+              vk::to_string(vk::Result(result)).c_str());
+        throw std::runtime_error("vmaAllocateMemoryForBuffer failed");
+    }
+
+    device.bindBufferMemory(staging.buffer, allocationInfo.deviceMemory,
+                            allocationInfo.offset);
+
+    staging.type           = BufferType::Any;
+    staging.allocationType = BufferAllocationType::Default;
+    staging.size           = size;
+    staging.offset         = 0;
+
+    *mapping = reinterpret_cast<uint8_t *>(allocationInfo.pMappedData);
+    assert(*mapping != nullptr);
+
+    return staging;
+}
+
+void Renderer::reserveStaging(WorkerContext &context, uint32_t size) {
+    // The caller holds context.mutex.
+    uint32_t offset = static_cast<uint32_t>(alignUp(context.stagingUsed, 16));
+
+    if (context.stagingMapping && offset + size <= context.staging.size) {
+        return;
+    }
+
+    if (context.stagingMapping) {
+        context.retiredStaging.emplace_back(std::move(context.staging));
+    }
+
+    context.staging = createStagingBuffer(std::max(size, stagingBlockSize),
+                                          &context.stagingMapping);
+    context.stagingUsed = 0;
+}
+
+void Renderer::stage(WorkerContext &         context,
+                     WorkerContext::Pending &pending,
+                     const void *            contents) {
+    // The caller holds context.mutex.
+    reserveStaging(context, pending.size);
+
+    uint32_t offset = static_cast<uint32_t>(alignUp(context.stagingUsed, 16));
+
+    std::memcpy(context.stagingMapping + offset, contents, pending.size);
+    context.stagingUsed = offset + pending.size;
+
+    pending.stagingBuffer = context.staging.buffer;
+    pending.stagingOffset = offset;
+    pending.stagingData   = context.stagingMapping + offset;
+    context.pending.emplace_back(std::move(pending));
+}
+
+void Renderer::flushWorkerContext(WorkerContext &context) {
+    std::vector<WorkerContext::Pending> pending;
+    std::vector<Buffer>                 retired;
+
+    {
+        std::lock_guard<std::mutex> lock(context.mutex);
+
+        if (context.pending.empty()) return;
+
+        std::swap(pending, context.pending);
+        std::swap(retired, context.retiredStaging);
+
+        // The copies recorded below read the current staging buffer, so the
+        // worker moves on to a fresh one.
+        if (context.stagingMapping) {
+            retired.emplace_back(std::move(context.staging));
+            context.stagingMapping = nullptr;
+            context.stagingUsed    = 0;
+        }
+    }
+
+    for (auto &p : pending) {
+        Buffer * destination = nullptr;
+        uint8_t *mapping     = nullptr;
+
+        if (p.reserved) {
+            Buffer &b = buffers.commit(p.handle);
+
+            if (isPooled(p.type, p.size)) {
+                mapping = allocatePooledBuffer(b, p.type, p.size);
+            } else {
+                b = std::move(p.buffer);
+            }
+
+            b.size          = p.size;
+            b.type          = p.type;
+            b.lastUsedFrame = currentFrame;
+
+            bufferBytes[static_cast<size_t>(p.type)] += p.size;
+
+            destination = &b;
+        } else if (buffers.contains(p.handle)) {
+            destination = &buffers.get(p.handle);
+        } else {
+            // Deleted before its contents ever arrived.
+            continue;
+        }
+
+        // Written by the worker already.
+        if (!p.stagingBuffer) continue;
+
+        // The staging buffer is only retired below, so this is still valid.
+        if (mapping) {
+            std::memcpy(mapping, p.stagingData, p.size);
+            continue;
+        }
+
+        UploadCopy copy;
+        copy.source      = p.stagingBuffer;
+        copy.destination = destination->buffer;
+        copy.region =
+            vk::BufferCopy(p.stagingOffset, destination->offset, p.size);
+        stagedCopies.push_back(copy);
+    }
+
+    for (auto &staging : retired) {
+        staging.lastUsedFrame = currentFrame;
+        retireResource(std::move(staging));
+    }
+}
+
+void Renderer::flushWorkerContexts() {
+    flushWorkerContext(mainContext);
+
+    std::lock_guard<std::mutex> lock(workerContextsMutex);
+    for (auto &context : workerContexts) { flushWorkerContext(*context); }
+}
+
+void Renderer::destroyWorkerContext(WorkerContext &context) {
+    std::lock_guard<std::mutex> lock(context.mutex);
+
+    // Anything still here was created after the final flush.
+    for (auto &p : context.pending) {
+        if (p.buffer.buffer) { deleteBufferInternal(p.buffer); }
+    }
+    context.pending.clear();
+
+    for (auto &staging : context.retiredStaging) {
+        deleteBufferInternal(staging);
+    }
+    context.retiredStaging.clear();
+
+    if (context.stagingMapping) {
+        deleteBufferInternal(context.staging);
+        context.stagingMapping = nullptr;
+        context.stagingUsed    = 0;
+    }
+}
+
+#pragma mark - Memory Budget
+
+void Renderer::markBufferUsed(BufferHandle handle) {
+    buffers.get(handle).lastUsedFrame = currentFrame;
+}
+
+void Renderer::setBufferEvictable(BufferHandle     handle,
+                                  EvictionCallback onEvict) {
+    assert(buffers.contains(handle));
+    assert(onEvict);
+
+    evictableBuffers.push_back({handle, std::move(onEvict)});
+}
+
+void Renderer::queryHeapBudgets(HeapSizes &usage, HeapSizes &budget) const {
+    usage.fill(0);
+    budget.fill(0);
+
+#ifdef VK_EXT_memory_budget
+    if (memoryBudgetExtension) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+        budgetProperties.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        VkPhysicalDeviceMemoryProperties2KHR properties = {};
+        properties.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        properties.pNext = &budgetProperties;
+
+        pfn_vkGetPhysicalDeviceMemoryProperties2KHR(physicalDevice,
+                                                    &properties);
+
+        for (unsigned int i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+            usage[i]  = budgetProperties.heapUsage[i];
+            budget[i] = budgetProperties.heapBudget[i];
+        }
+        return;
+    }
+#endif
+
+    VmaStats stats = {};
+    vmaCalculateStats(allocator, &stats);
+
+    for (unsigned int i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        usage[i]  = stats.memoryHeap[i].usedBytes;
+        budget[i] = memoryProperties.memoryHeaps[i].size;
+    }
+}
+
+MemoryStatistics Renderer::getMemoryStatistics() const {
+    MemoryStatistics statistics;
+
+    statistics.bufferBytes     = bufferBytes;
+    statistics.budgetExtension = memoryBudgetExtension;
+    statistics.evictedBytes    = evictedBytes;
+
+    statistics.directBufferWrites = directWriteMemoryTypes != 0;
+
+    for (auto &queue : streams) {
+        for (auto &stream : queue) {
+            statistics.streamingBytes += stream.size - stream.uploaded;
+        }
+    }
+
+    HeapSizes usage, budget;
+    queryHeapBudgets(usage, budget);
+
+    auto heaps = memoryProperties.memoryHeapCount;
+    statistics.heapUsage.assign(usage.begin(), usage.begin() + heaps);
+    statistics.heapBudget.assign(budget.begin(), budget.begin() + heaps);
+
+    return statistics;
+}
+
+void Renderer::enforceMemoryBudget() {
+    size_t overshoot = 0;
+
+    if (memoryBudget != 0) {
+        size_t used = 0;
+        for (auto bytes : bufferBytes) { used += bytes; }
+
+        if (used > memoryBudget) { overshoot = used - memoryBudget; }
+    }
+
+    // The extension accounts for other processes too, which is what keeps
+    // a shared workstation from running out of memory. Its figure includes
+    // the graveyard, which is already on its way out.
+    if (memoryBudgetExtension) {
+        HeapSizes heapUsage, heapBudget;
+        queryHeapBudgets(heapUsage, heapBudget);
+
+        size_t used = 0, budget = 0;
+        for (unsigned int i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+            if (!(memoryProperties.memoryHeaps[i].flags
+                  & vk::MemoryHeapFlagBits::eDeviceLocal))
+                continue;
+
+            used += heapUsage[i];
+            budget += heapBudget[i];
+        }
+        used -= std::min(used, graveyardBytes);
+
+        if (used > budget) { overshoot = std::max(overshoot, used - budget); }
+    }
+
+    if (overshoot == 0) return;
+
+    LOG_SCOPE_F(INFO, "Over memory budget by %zu bytes, evicting", overshoot);
+
+    evictableBuffers.erase(
+        std::remove_if(evictableBuffers.begin(), evictableBuffers.end(),
+                       [this](const EvictableBuffer &e) {
+                           return !buffers.contains(e.handle);
+                       }),
+        evictableBuffers.end());
+
+    std::sort(evictableBuffers.begin(), evictableBuffers.end(),
+              [this](const EvictableBuffer &a, const EvictableBuffer &b) {
+                  return buffers.get(a.handle).lastUsedFrame
+                         < buffers.get(b.handle).lastUsedFrame;
+              });
+
+    size_t freed   = 0;
+    size_t victims = 0;
+    for (auto &e : evictableBuffers) {
+        if (freed >= overshoot) break;
+
+        // Everything from here on is needed by the frame being recorded.
+        const Buffer &b = buffers.get(e.handle);
+        if (b.lastUsedFrame >= currentFrame) break;
+
+        freed += b.size;
+        victims++;
+    }
+
+    if (victims == 0) {
+        LOG_F(WARNING, "Nothing left to evict");
+        return;
+    }
+
+    // Callbacks may well create and register new buffers, so take the
+    // victims out of the list before calling any of them.
+    std::vector<EvictableBuffer> evicted(
+        std::make_move_iterator(evictableBuffers.begin()),
+        std::make_move_iterator(evictableBuffers.begin() + victims));
+    evictableBuffers.erase(evictableBuffers.begin(),
+                           evictableBuffers.begin() + victims);
+
+    LOG_F(INFO, "Evicting %zu buffers (%zu bytes)", victims, freed);
+    evictedBytes += freed;
+
+    for (auto &e : evicted) {
+        deleteBuffer(e.handle);
+        e.onEvict(e.handle);
+    }
+}
+
+#pragma mark - Host Allocations
+
+HostAllocationStatistics Renderer::getHostAllocationStatistics() const {
+    if (!hostAllocator) return HostAllocationStatistics();
+
+    return hostAllocator->getStatistics();
 }
 
 }; // namespace renderer
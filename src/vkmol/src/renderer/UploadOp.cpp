@@ -31,16 +31,11 @@ UploadOp::UploadOp(UploadOp &&other) noexcept
 : commandBuffer(other.commandBuffer)
 , semaphore(other.semaphore)
 , semaphoreWaitMask(other.semaphoreWaitMask)
-, stagingBuffer(other.stagingBuffer)
-, memory(other.memory)
-, allocationInfo(other.allocationInfo)
 , imageAcquireBarriers(std::move(other.imageAcquireBarriers))
 , bufferAcquireBarriers(std::move(other.bufferAcquireBarriers)) {
     other.commandBuffer     = vk::CommandBuffer();
     other.semaphore         = vk::Semaphore();
     other.semaphoreWaitMask = vk::PipelineStageFlags();
-    other.stagingBuffer     = vk::Buffer();
-    other.memory            = nullptr;
     assert(other.imageAcquireBarriers.empty());
     assert(other.bufferAcquireBarriers.empty());
 }
@@ -53,8 +48,6 @@ UploadOp &UploadOp::operator=(UploadOp &&other) noexcept {
     assert(!commandBuffer);
     assert(!semaphore);
     assert(!semaphoreWaitMask);
-    assert(!stagingBuffer);
-    assert(!memory);
     assert(imageAcquireBarriers.empty());
     assert(bufferAcquireBarriers.empty());
 
@@ -67,20 +60,12 @@ UploadOp &UploadOp::operator=(UploadOp &&other) noexcept {
     semaphoreWaitMask = other.semaphoreWaitMask;
     other.semaphoreWaitMask = vk::PipelineStageFlags();
 
-    stagingBuffer = other.stagingBuffer;
-    other.stagingBuffer     = vk::Buffer();
-
-    memory = other.memory;
-    other.memory            = nullptr;
-
     imageAcquireBarriers     = std::move(other.imageAcquireBarriers);
     assert(other.imageAcquireBarriers.empty());
 
     bufferAcquireBarriers     = std::move(other.bufferAcquireBarriers);
     assert(other.bufferAcquireBarriers.empty());
 
-    allocationInfo      = other.allocationInfo;
-
     return *this;
 }
 
@@ -88,8 +73,6 @@ UploadOp::~UploadOp() noexcept {
     assert(!commandBuffer);
     assert(!semaphore);
     assert(!semaphoreWaitMask);
-    assert(!stagingBuffer);
-    assert(!memory);
 }
 
 }; // namespace renderer
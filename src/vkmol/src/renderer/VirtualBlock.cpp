@@ -0,0 +1,115 @@
+/*
+  Copyright 2018, Dylan Lukes, University of Pittsburgh
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "vkmol/renderer/VirtualBlock.h"
+
+#include <cassert>
+#include <iterator>
+
+namespace vkmol {
+namespace renderer {
+
+VirtualBlock::VirtualBlock(uint32_t size) : size(size), used(0) {
+    if (size > 0) { insertFreeRange(0, size); }
+}
+
+void VirtualBlock::insertFreeRange(uint32_t offset, uint32_t size) {
+    assert(size > 0);
+    freeByOffset.emplace(offset, size);
+    freeBySize.emplace(size, offset);
+}
+
+void VirtualBlock::eraseFreeRange(std::map<uint32_t, uint32_t>::iterator it) {
+    auto range = freeBySize.equal_range(it->second);
+    for (auto sized = range.first; sized != range.second; ++sized) {
+        if (sized->second == it->first) {
+            freeBySize.erase(sized);
+            break;
+        }
+    }
+    freeByOffset.erase(it);
+}
+
+bool VirtualBlock::allocate(uint32_t size, uint32_t alignment,
+                            uint32_t &offset) {
+    assert(size > 0);
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+    // Best fit: the smallest free ranges that are large enough come first,
+    // and usually the first one also satisfies the alignment.
+    for (auto it = freeBySize.lower_bound(size); it != freeBySize.end();
+         ++it) {
+        uint32_t rangeOffset = it->second;
+        uint32_t rangeSize   = it->first;
+
+        uint32_t aligned = (rangeOffset + alignment - 1) & ~(alignment - 1);
+        uint32_t padding = aligned - rangeOffset;
+        if (padding + size > rangeSize) continue;
+
+        eraseFreeRange(freeByOffset.find(rangeOffset));
+
+        // Padding stays free on its own so it can coalesce later.
+        if (padding > 0) { insertFreeRange(rangeOffset, padding); }
+
+        uint32_t tail = rangeSize - padding - size;
+        if (tail > 0) { insertFreeRange(aligned + size, tail); }
+
+        used += size;
+        offset = aligned;
+        return true;
+    }
+
+    return false;
+}
+
+void VirtualBlock::free(uint32_t offset, uint32_t size) {
+    assert(size > 0);
+    assert(offset + size <= this->size);
+    assert(used >= size);
+
+    used -= size;
+
+    auto next = freeByOffset.lower_bound(offset);
+    assert(next == freeByOffset.end() || next->first >= offset + size);
+
+    if (next != freeByOffset.end() && next->first == offset + size) {
+        size += next->second;
+        auto merged = next++;
+        eraseFreeRange(merged);
+    }
+
+    if (next != freeByOffset.begin()) {
+        auto prev = std::prev(next);
+        assert(prev->first + prev->second <= offset);
+
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            eraseFreeRange(prev);
+        }
+    }
+
+    insertFreeRange(offset, size);
+}
+
+}; // namespace renderer
+}; // namespace vkmol
@@ -5,6 +5,7 @@ namespace vkmol {
 namespace shaders {
 #include "minimal.vert.h"
 #include "minimal.frag.h"
+#include "quantized.vert.h"
 }
 }
 
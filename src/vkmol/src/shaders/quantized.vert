@@ -0,0 +1,46 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Vertices in the QuantizedVertex layout (see vkmol/renderer/Quantization.h).
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// The QuantizationBounds the vertices were encoded with, as laid out in C++.
+layout(push_constant) uniform Bounds {
+    float origin[3];
+    float extent[3];
+} bounds;
+
+layout(location = 0) in vec4 inPosition; // R16G16B16A16_UNORM
+layout(location = 1) in vec2 inNormal;   // R16G16_SNORM, octahedral
+layout(location = 2) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragNormal;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0,
+                                        n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+void main() {
+    vec3 origin = vec3(bounds.origin[0], bounds.origin[1], bounds.origin[2]);
+    vec3 extent = vec3(bounds.extent[0], bounds.extent[1], bounds.extent[2]);
+    vec3 position = origin + extent * inPosition.xyz;
+
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(position, 1.0);
+    fragColor   = inColor;
+    fragNormal  = mat3(ubo.model) * decodeOctahedral(inNormal);
+}